@@ -0,0 +1,427 @@
+#include <output_data_stream.h>
+#include <input_data_stream.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Encode / decode throughput of the common value kinds. Every case is run in both format versions and the
+ * best of `repetitions` runs is reported, one JSON object per line:
+ * {"case": ..., "format": ..., "op": "encode" | "decode", "items": ..., "bytes": ..., "seconds": ...,
+ *  "mb_per_s": ..., "items_per_s": ...}
+ */
+
+namespace {
+
+struct Point : public Serializable {
+    int32_t x = 0;
+    int32_t y = 0;
+    std::string label;
+
+    ReadStatus TryRead(InputDataStream* in) override {
+        ReadStatus status = kStatusOk;
+        if ((status = in->TryRead(&x)) != kStatusOk || (status = in->TryRead(&y)) != kStatusOk) {
+            return status;
+        }
+        return in->TryRead(&label);
+    }
+
+    void WriteValue(OutputDataStream* out) const override {
+        out->Write(x);
+        out->Write(y);
+        out->Write(label);
+    }
+};
+
+}  // namespace
+
+template <>
+struct StructFields<Point> {
+    static constexpr auto kFields = std::make_tuple(&Point::x, &Point::y, &Point::label);
+};
+
+/* Same fields and encoding as Point, without the virtual interface */
+struct ReflectedPoint {
+    int32_t x = 0;
+    int32_t y = 0;
+    std::string label;
+};
+
+OOSF_REFLECT(ReflectedPoint, x, y, label)
+
+namespace {
+
+struct Case {
+    std::string name;
+    int string_cache_size;
+    int64_t items;
+    std::function<void(OutputDataStream*)> encode;
+    std::function<bool(InputDataStream*)> decode;
+    /* Cases with a dictionary or format flags only run in OOSFv2 */
+    std::shared_ptr<const StringDictionary> dictionary = nullptr;
+    int flags = 0;
+};
+
+int repetitions = 5;
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Report(const Case& test, FormatVersion version, const char* op, size_t bytes, double seconds) {
+    std::printf("{\"case\": \"%s\", \"format\": \"OOSFv%d\", \"op\": \"%s\", \"items\": %lld, \"bytes\": %zu, "
+                "\"seconds\": %.6f, \"mb_per_s\": %.1f, \"items_per_s\": %.0f}\n",
+                test.name.c_str(), static_cast<int>(version), op, static_cast<long long>(test.items), bytes,
+                seconds, bytes / seconds / 1e6, test.items / seconds);
+}
+
+bool Run(const Case& test, FormatVersion version) {
+    if ((test.dictionary || test.flags != 0) && version == kFormatV1) {
+        return true;
+    }
+    MemoryOutputSink sink;
+    double encode_time = 1e9;
+    for (int i = 0; i < repetitions; ++i) {
+        sink.Clear();
+        auto start = std::chrono::steady_clock::now();
+        OutputDataStream out(&sink, test.string_cache_size, version, test.flags, test.dictionary.get());
+        out.RegisterClass<Point>("Point");
+        out.RegisterClass<ReflectedPoint>();
+        test.encode(&out);
+        out.Flush();
+        encode_time = std::min(encode_time, Seconds(start));
+    }
+    Report(test, version, "encode", sink.Size(), encode_time);
+
+    double decode_time = 1e9;
+    for (int i = 0; i < repetitions; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        MemoryInputSource source(sink.Data(), sink.Size());
+        InputDataStream in(&source, nullptr, test.dictionary.get());
+        in.RegisterClass<Point>("Point");
+        in.RegisterClass<ReflectedPoint>();
+        if (!test.decode(&in)) {
+            std::fprintf(stderr, "%s: decoding failed\n", test.name.c_str());
+            return false;
+        }
+        decode_time = std::min(decode_time, Seconds(start));
+    }
+    Report(test, version, "decode", sink.Size(), decode_time);
+    return true;
+}
+
+template <class T>
+Case ScalarCase(const std::string& name, int64_t count) {
+    return {name, 0, count,
+            [count](OutputDataStream* out) {
+                for (int64_t i = 0; i < count; ++i) {
+                    out->Write(static_cast<T>(i));
+                }
+            },
+            [count](InputDataStream* in) {
+                T value;
+                for (int64_t i = 0; i < count; ++i) {
+                    if (in->TryRead(&value) != kStatusOk) {
+                        return false;
+                    }
+                }
+                return true;
+            }};
+}
+
+template <class T>
+Case VectorCase(const std::string& name, int64_t length, int64_t count) {
+    std::vector<T> vec(length);
+    for (int64_t i = 0; i < length; ++i) {
+        vec[i] = static_cast<T>(i * 7);
+    }
+    return {name, 0, length * count,
+            [vec, count](OutputDataStream* out) {
+                for (int64_t i = 0; i < count; ++i) {
+                    out->Write(vec);
+                }
+            },
+            [count](InputDataStream* in) {
+                std::vector<T> value;
+                for (int64_t i = 0; i < count; ++i) {
+                    if (in->TryRead(&value) != kStatusOk) {
+                        return false;
+                    }
+                }
+                return true;
+            }};
+}
+
+std::vector<std::string> Words(int distinct, size_t length) {
+    std::vector<std::string> words;
+    for (int i = 0; i < distinct; ++i) {
+        std::string word = "w" + std::to_string(i);
+        word.resize(length, 'x');
+        words.push_back(word);
+    }
+    return words;
+}
+
+Case StringCase(int string_cache_size, int64_t count) {
+    auto words = Words(256, 16);
+    return {"string16_cache" + std::to_string(string_cache_size), string_cache_size, count,
+            [words, count](OutputDataStream* out) {
+                for (int64_t i = 0; i < count; ++i) {
+                    out->Write(words[(i * 31) % words.size()]);
+                }
+            },
+            [count](InputDataStream* in) {
+                std::string value;
+                for (int64_t i = 0; i < count; ++i) {
+                    if (in->TryRead(&value) != kStatusOk) {
+                        return false;
+                    }
+                }
+                return true;
+            }};
+}
+
+/* The strings of StringCase, all found in a shared dictionary */
+Case DictionaryCase(int64_t count) {
+    Case test = StringCase(0, count);
+    test.name = "string16_dictionary";
+    test.dictionary = std::make_shared<StringDictionary>(Words(256, 16));
+    return test;
+}
+
+/* Vectors of the strings of StringCase, so repeats fall within one vector */
+Case StringVectorCase(int64_t length, int64_t count) {
+    auto words = Words(256, 16);
+    std::vector<std::string> vec(length);
+    for (int64_t i = 0; i < length; ++i) {
+        vec[i] = words[(i * 31) % words.size()];
+    }
+    return {"vector_string16_cache1024", 1024, length * count,
+            [vec, count](OutputDataStream* out) {
+                for (int64_t i = 0; i < count; ++i) {
+                    out->Write(vec);
+                }
+            },
+            [count](InputDataStream* in) {
+                std::vector<std::string> value;
+                for (int64_t i = 0; i < count; ++i) {
+                    if (in->TryRead(&value) != kStatusOk) {
+                        return false;
+                    }
+                }
+                return true;
+            }};
+}
+
+Case MapCase(int64_t size, int64_t count) {
+    std::map<std::string, int32_t> map;
+    auto words = Words(size, 12);
+    for (int64_t i = 0; i < size; ++i) {
+        map[words[i]] = i;
+    }
+    return {"map_string_int32", 0, size * count,
+            [map, count](OutputDataStream* out) {
+                for (int64_t i = 0; i < count; ++i) {
+                    out->Write(map);
+                }
+            },
+            [count](InputDataStream* in) {
+                for (int64_t i = 0; i < count; ++i) {
+                    std::map<std::string, int32_t> value;
+                    if (in->TryRead(&value) != kStatusOk) {
+                        return false;
+                    }
+                }
+                return true;
+            }};
+}
+
+/* Integer keys and values, interleaved or columnar, decoded into `Map` */
+template <class Map>
+Case NumericMapCase(const std::string& name, bool columnar, int64_t size, int64_t count) {
+    std::map<int32_t, double> map;
+    for (int64_t i = 0; i < size; ++i) {
+        map[i * 3] = i * 0.5;
+    }
+    return {name, 0, size * count,
+            [map, columnar, count](OutputDataStream* out) {
+                for (int64_t i = 0; i < count; ++i) {
+                    if (columnar) {
+                        out->WriteAsColumnarMap(map.begin(), map.end());
+                    } else {
+                        out->Write(map);
+                    }
+                }
+            },
+            [count](InputDataStream* in) {
+                for (int64_t i = 0; i < count; ++i) {
+                    Map value;
+                    if (in->TryRead(&value) != kStatusOk) {
+                        return false;
+                    }
+                }
+                return true;
+            }};
+}
+
+template <class PointType>
+Case StructCase(const std::string& name, int64_t count) {
+    auto words = Words(64, 8);
+    return {name, 64, count,
+            [words, count](OutputDataStream* out) {
+                PointType point;
+                for (int64_t i = 0; i < count; ++i) {
+                    point.x = i;
+                    point.y = -i;
+                    point.label = words[i % words.size()];
+                    out->Write(point);
+                }
+            },
+            [count](InputDataStream* in) {
+                PointType point;
+                for (int64_t i = 0; i < count; ++i) {
+                    if (in->TryRead(&point) != kStatusOk) {
+                        return false;
+                    }
+                }
+                return true;
+            }};
+}
+
+/* Vectors of structs, element by element or as columns */
+Case StructVectorCase(const std::string& name, bool columnar, int64_t length, int64_t count) {
+    auto words = Words(64, 8);
+    std::vector<Point> points(length);
+    for (int64_t i = 0; i < length; ++i) {
+        points[i].x = i;
+        points[i].y = -i;
+        points[i].label = words[i % words.size()];
+    }
+    return {name, 64, length * count,
+            [points, columnar, count](OutputDataStream* out) {
+                for (int64_t i = 0; i < count; ++i) {
+                    if (columnar) {
+                        out->WriteAsColumnarVector(points.begin(), points.end());
+                    } else {
+                        out->Write(points);
+                    }
+                }
+            },
+            [count](InputDataStream* in) {
+                std::vector<Point> value;
+                for (int64_t i = 0; i < count; ++i) {
+                    if (in->TryRead(&value) != kStatusOk) {
+                        return false;
+                    }
+                }
+                return true;
+            }};
+}
+
+/* Sums what it is shown, so the walk cannot be optimized away */
+class SumVisitor : public ValueVisitor {
+public:
+    void OnInt(int64_t value, int) override {
+        sum += value;
+    }
+
+    void OnFloat(double value, int) override {
+        sum += value;
+    }
+
+    void OnString(std::string_view str) override {
+        sum += str.size();
+    }
+
+    double sum = 0;
+};
+
+/* Runs of doubles are summed in place, without a call per value */
+class RunVisitor : public SumVisitor {
+public:
+    void OnValues(int tag, const char* data, size_t count) override {
+        if (tag != TYPE_DOUBLE) {
+            return SumVisitor::OnValues(tag, data, count);
+        }
+        for (size_t i = 0; i < count; ++i, data += sizeof(double)) {
+            double value;
+            std::memcpy(&value, data, sizeof(value));
+            sum += value;
+        }
+    }
+};
+
+/* Walks the values of `test` with VisitValue() instead of decoding them */
+template <class Visitor>
+Case VisitCase(const std::string& name, Case test, int64_t count) {
+    test.name = name;
+    test.decode = [count](InputDataStream* in) {
+        Visitor visitor;
+        for (int64_t i = 0; i < count; ++i) {
+            if (in->VisitValue(&visitor) != kStatusOk) {
+                return false;
+            }
+        }
+        return visitor.sum != 0;
+    };
+    return test;
+}
+
+/*
+ * `test` with kFlagFramedValues. Strings only refer back within their own frame, so repeats across sibling
+ * frames, such as the labels of consecutive structs, are written out again: compare the sizes with `test`.
+ */
+Case FramedCase(const std::string& name, Case test) {
+    test.name = name;
+    test.flags = kFlagFramedValues;
+    return test;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        repetitions = std::max(1, std::atoi(argv[1]));
+    }
+
+    std::vector<Case> cases;
+    cases.push_back(ScalarCase<int32_t>("scalar_int32", 1 << 20));
+    cases.push_back(ScalarCase<int64_t>("scalar_int64", 1 << 20));
+    cases.push_back(ScalarCase<double>("scalar_double", 1 << 20));
+    cases.push_back(VectorCase<int32_t>("vector_int32", 1 << 16, 64));
+    cases.push_back(VectorCase<double>("vector_double", 1 << 16, 64));
+    for (int string_cache_size : {0, 16, 1024}) {
+        cases.push_back(StringCase(string_cache_size, 1 << 19));
+    }
+    cases.push_back(DictionaryCase(1 << 19));
+    cases.push_back(StringVectorCase(1 << 12, 128));
+    cases.push_back(FramedCase("vector_string16_cache1024_framed", StringVectorCase(1 << 12, 128)));
+    cases.push_back(MapCase(1 << 10, 256));
+    cases.push_back(NumericMapCase<std::map<int32_t, double>>("map_int32_double", false, 1 << 16, 16));
+    cases.push_back(NumericMapCase<std::map<int32_t, double>>("map_int32_double_columnar", true, 1 << 16, 16));
+    cases.push_back(NumericMapCase<FlatMap<int32_t, double>>("flat_map_int32_double_columnar", true, 1 << 16, 16));
+    cases.push_back(StructCase<Point>("struct_point", 1 << 19));
+    cases.push_back(StructCase<ReflectedPoint>("struct_point_reflected", 1 << 19));
+    cases.push_back(FramedCase("struct_point_framed", StructCase<Point>("", 1 << 19)));
+    cases.push_back(StructVectorCase("vector_struct_point", false, 1 << 12, 128));
+    cases.push_back(StructVectorCase("vector_struct_point_columnar", true, 1 << 12, 128));
+    cases.push_back(FramedCase("vector_struct_point_framed", StructVectorCase("", false, 1 << 12, 128)));
+    cases.push_back(VisitCase<SumVisitor>("visit_vector_double", VectorCase<double>("", 1 << 16, 64), 64));
+    cases.push_back(VisitCase<RunVisitor>("visit_vector_double_runs", VectorCase<double>("", 1 << 16, 64), 64));
+    cases.push_back(VisitCase<SumVisitor>("visit_map_string_int32", MapCase(1 << 10, 256), 256));
+
+    for (const auto& test : cases) {
+        for (FormatVersion version : {kFormatV1, kFormatV2}) {
+            if (!Run(test, version)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
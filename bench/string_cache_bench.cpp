@@ -0,0 +1,65 @@
+#include <output_data_stream.h>
+#include <input_data_stream.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Cost of writing and reading strings that hit the cache, per string, for several string lengths */
+
+namespace {
+
+constexpr int kCacheSize = 64;
+constexpr int kDistinct = 32;
+constexpr int kStrings = 1 << 18;
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Run(size_t length) {
+    std::vector<std::string> strings;
+    for (int i = 0; i < kDistinct; ++i) {
+        std::string str(length, 'a' + i % 26);
+        str[length - 1] = static_cast<char>('0' + i);
+        strings.push_back(str);
+    }
+
+    MemoryOutputSink sink;
+    auto start = std::chrono::steady_clock::now();
+    {
+        OutputDataStream out(&sink, kCacheSize, kFormatV2);
+        for (int i = 0; i < kStrings; ++i) {
+            out.Write(strings[i % kDistinct]);
+        }
+        out.Flush();
+    }
+    double write_time = Seconds(start);
+
+    MemoryInputSource source(sink.Data(), sink.Size());
+    InputDataStream in(&source);
+    std::string_view view;
+    size_t total = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kStrings; ++i) {
+        if (in.TryRead(&view) != kStatusOk) {
+            std::fprintf(stderr, "read failed at %d\n", i);
+            return;
+        }
+        total += view.size();
+    }
+    double read_time = Seconds(start);
+
+    std::printf("length=%zu write_ns=%.1f read_ns=%.1f bytes=%zu check=%zu\n", length,
+                write_time * 1e9 / kStrings, read_time * 1e9 / kStrings, sink.Size(), total);
+}
+
+}  // namespace
+
+int main() {
+    for (size_t length : {8, 64, 512, 4096}) {
+        Run(length);
+    }
+    return 0;
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/*
+ * Map kept as one vector of entries sorted by key: a single allocation and binary search lookups. InputDataStream
+ * fills it with one replace(), which takes linear time when the keys arrive sorted, as std::map writes them.
+ */
+template <class K, class V, class Compare = std::less<K>, class Alloc = std::allocator<std::pair<K, V>>>
+class FlatMap {
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<K, V>;
+    using key_compare = Compare;
+    using allocator_type = Alloc;
+    using container_type = std::vector<value_type, Alloc>;
+    using size_type = size_t;
+    using iterator = typename container_type::iterator;
+    using const_iterator = typename container_type::const_iterator;
+
+    FlatMap() = default;
+
+    explicit FlatMap(const Alloc& alloc) : entries_(alloc) {
+    }
+
+    FlatMap(std::initializer_list<value_type> entries) {
+        replace(container_type(entries));
+    }
+
+    size_t size() const {
+        return entries_.size();
+    }
+
+    bool empty() const {
+        return entries_.empty();
+    }
+
+    void clear() {
+        entries_.clear();
+    }
+
+    void reserve(size_t size) {
+        entries_.reserve(size);
+    }
+
+    allocator_type get_allocator() const {
+        return entries_.get_allocator();
+    }
+
+    iterator begin() {
+        return entries_.begin();
+    }
+
+    iterator end() {
+        return entries_.end();
+    }
+
+    const_iterator begin() const {
+        return entries_.begin();
+    }
+
+    const_iterator end() const {
+        return entries_.end();
+    }
+
+    iterator lower_bound(const K& key) {
+        return std::lower_bound(entries_.begin(), entries_.end(), key, KeyLess{compare_});
+    }
+
+    const_iterator lower_bound(const K& key) const {
+        return std::lower_bound(entries_.begin(), entries_.end(), key, KeyLess{compare_});
+    }
+
+    iterator find(const K& key) {
+        iterator iter = lower_bound(key);
+        return iter != end() && !compare_(key, iter->first) ? iter : end();
+    }
+
+    const_iterator find(const K& key) const {
+        const_iterator iter = lower_bound(key);
+        return iter != end() && !compare_(key, iter->first) ? iter : end();
+    }
+
+    size_t count(const K& key) const {
+        return find(key) != end();
+    }
+
+    V& at(const K& key) {
+        iterator iter = find(key);
+        if (iter == end()) {
+            throw std::out_of_range("FlatMap::at");
+        }
+        return iter->second;
+    }
+
+    const V& at(const K& key) const {
+        const_iterator iter = find(key);
+        if (iter == end()) {
+            throw std::out_of_range("FlatMap::at");
+        }
+        return iter->second;
+    }
+
+    V& operator[](const K& key) {
+        return emplace(key, V()).first->second;
+    }
+
+    /* Like std::map, an existing key keeps its value */
+    template <class Key, class Value>
+    std::pair<iterator, bool> emplace(Key&& key, Value&& value) {
+        iterator iter = lower_bound(key);
+        if (iter != end() && !compare_(key, iter->first)) {
+            return {iter, false};
+        }
+        return {entries_.emplace(iter, std::forward<Key>(key), std::forward<Value>(value)), true};
+    }
+
+    /* Appending in key order is O(1) with end() as the hint */
+    template <class Key, class Value>
+    iterator emplace_hint(const_iterator hint, Key&& key, Value&& value) {
+        if (hint == end() && (empty() || compare_(entries_.back().first, key))) {
+            entries_.emplace_back(std::forward<Key>(key), std::forward<Value>(value));
+            return std::prev(end());
+        }
+        return emplace(std::forward<Key>(key), std::forward<Value>(value)).first;
+    }
+
+    iterator erase(const_iterator iter) {
+        return entries_.erase(iter);
+    }
+
+    size_t erase(const K& key) {
+        iterator iter = find(key);
+        if (iter == end()) {
+            return 0;
+        }
+        entries_.erase(iter);
+        return 1;
+    }
+
+    /* Hands the entries out, leaving the map empty */
+    container_type extract() && {
+        container_type entries = std::move(entries_);
+        entries_.clear();
+        return entries;
+    }
+
+    /* Takes entries in any order; of equal keys the first one stays. Sorted unique entries are only checked */
+    void replace(container_type&& entries) {
+        entries_ = std::move(entries);
+        KeyLess less{compare_};
+        auto unordered = [&less](const value_type& left, const value_type& right) {
+            return !less(left, right);
+        };
+        if (std::adjacent_find(entries_.begin(), entries_.end(), unordered) == entries_.end()) {
+            return;
+        }
+        std::stable_sort(entries_.begin(), entries_.end(), less);
+        auto equal = [&less](const value_type& left, const value_type& right) {
+            return !less(left, right) && !less(right, left);
+        };
+        entries_.erase(std::unique(entries_.begin(), entries_.end(), equal), entries_.end());
+    }
+
+    bool operator==(const FlatMap& other) const {
+        return entries_ == other.entries_;
+    }
+
+    bool operator!=(const FlatMap& other) const {
+        return entries_ != other.entries_;
+    }
+
+private:
+    struct KeyLess {
+        const Compare& compare;
+
+        bool operator()(const value_type& left, const value_type& right) const {
+            return compare(left.first, right.first);
+        }
+
+        bool operator()(const value_type& left, const K& right) const {
+            return compare(left.first, right);
+        }
+    };
+
+    container_type entries_;
+    Compare compare_;
+};
@@ -1,8 +1,13 @@
 #pragma once
 
 #include <cstdio>
+#include <cstdint>
+#include <limits>
 #include <vector>
 #include <map>
+#include <array>
+#include <tuple>
+#include <utility>
 #include <memory>
 #include <deque>
 #include <stack>
@@ -12,22 +17,50 @@
 #include <unordered_map>
 #include <typeinfo>
 #include <typeindex>
+#include <string_view>
+#include <memory_resource>
+#include <iterator>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include "input_source.h"
+#include "vector_view.h"
+#include "packed_vector.h"
+#include "xor_compression.h"
+#include "type_signature.h"
+#include "flat_map.h"
+#include "struct_fields.h"
+#include "string_dictionary.h"
+#include "stream_stats.h"
+#include "value_visitor.h"
 #include "log.h"
 
+template <class T>
+class VectorCursor;
+
+template <class K, class V>
+class MapCursor;
+
 class InputDataStream {
 public:
     using String = std::shared_ptr<const char[]>;
 
-    explicit InputDataStream(std::FILE* file) : file_(file) {
-        String signature;
-        if (TryRead(&signature) != kStatusOk || std::strcmp("OOSFv1", signature.get()) != 0) {
-            corrupted_ = true;
-        }
-        int64_t cache_size = 0;
-        if (TryReadMinimal(&cache_size) != kStatusOk) {
-            corrupted_ = true;
-        }
-        string_cache_size_ = cache_size;
+    /*
+     * Streams written with a shared StringDictionary can only be read given the same `dictionary`.
+     * `max_allocation` is the initial SetMaxAllocation(), which already applies to the header.
+     */
+    explicit InputDataStream(std::FILE* file, std::pmr::memory_resource* resource = nullptr,
+                             const StringDictionary* dictionary = nullptr, uint64_t max_allocation = UINT64_MAX)
+        : owned_source_(new FileInputSource(file)), source_(owned_source_.get()), resource_(resource),
+          max_allocation_(max_allocation), shared_dictionary_(dictionary) {
+        ReadHeader();
+    }
+
+    explicit InputDataStream(InputSource* source, std::pmr::memory_resource* resource = nullptr,
+                             const StringDictionary* dictionary = nullptr, uint64_t max_allocation = UINT64_MAX)
+        : source_(source), resource_(resource), max_allocation_(max_allocation), shared_dictionary_(dictionary) {
+        ReadHeader();
     }
 
     ~InputDataStream() {}
@@ -39,6 +72,156 @@ public:
         return !corrupted_;
     }
 
+    /*
+     * Why the stream cannot be read from its start, kStatusOk if it can: kStatusBadType for another format or
+     * for a shared dictionary other than the one the stream was written with, kStatusUnsupported for flags of
+     * a newer writer, kStatusLimitExceeded for a header beyond the maximum allocation.
+     */
+    ReadStatus HeaderStatus() const {
+        return header_status_;
+    }
+
+    /*
+     * Strings decoded from now on are allocated from `resource` (nullptr means new[]). The stream itself never
+     * keeps memory from it, so an arena may be released once the objects decoded from it are gone.
+     * Keys and values of std::pmr containers come from the container's own allocator.
+     */
+    void SetMemoryResource(std::pmr::memory_resource* resource) {
+        resource_ = resource;
+    }
+
+    std::pmr::memory_resource* GetMemoryResource() const {
+        return resource_;
+    }
+
+#ifdef OOSF_ENABLE_STATS
+    /* Streams of ReadRecordsParallel() workers count on their own */
+    StreamStats GetStats() const {
+        return stats_.stats;
+    }
+#endif
+
+    /* Expects the start of a record; strings and classes of the previous record are forgotten */
+    ReadStatus BeginRecord() {
+        if (corrupted_) {
+            return kStatusReadError;
+        }
+        int ch = PeekByte();
+        if (ch != TYPE_RECORD) {
+            return ch < 0 ? kStatusReadError : kStatusBadType;
+        }
+        GetByte();
+        string_counter_ = 0;
+        class_table_.clear();
+        return kStatusOk;
+    }
+
+    /* Jumps to record number `record` using the index at the end of the stream and begins it */
+    ReadStatus Seek(int64_t record) {
+        if (header_status_ != kStatusOk) {
+            return kStatusReadError;
+        }
+        if (!index_loaded_) {
+            if (ReadStatus status = LoadIndex(); status != kStatusOk) {
+                return status;
+            }
+        }
+        if (record < 0 || static_cast<uint64_t>(record) >= record_offsets_.size()) {
+            return kStatusReadError;
+        }
+        if (!Jump(record_offsets_[record])) {
+            corrupted_ = true;
+            return kStatusReadError;
+        }
+        corrupted_ = false;
+        return BeginRecord();
+    }
+
+    /*
+     * Decodes every indexed record concurrently on `threads` threads (all cores by default): decode(i, stream)
+     * reads record i from a private stream that shares the source memory and registered classes but has no
+     * memory resource. Needs a contiguous source. Returns the failure of the lowest failing record, or
+     * rethrows the first exception. This stream stays where it was.
+     */
+    template <class Decode>
+    ReadStatus ReadRecordsParallel(Decode decode, int threads = 0) {
+        if (!source_->Data()) {
+            return kStatusUnsupported;
+        }
+        if (header_status_ != kStatusOk) {
+            return kStatusReadError;
+        }
+        if (!index_loaded_) {
+            if (ReadStatus status = LoadIndex(); status != kStatusOk) {
+                return status;
+            }
+        }
+        size_t count = record_offsets_.size();
+        if (threads <= 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        threads = std::min<size_t>(threads, std::max<size_t>(count, 1));
+
+        std::atomic<size_t> next{0};
+        std::atomic<bool> stop{false};
+        std::mutex mutex;
+        size_t failed = count;
+        ReadStatus result = kStatusOk;
+        std::exception_ptr error;
+
+        auto worker = [&] {
+            MemoryInputSource source(source_->Data(), source_->Size());
+            InputDataStream segment(&source, *this);
+            for (size_t index; !stop && (index = next++) < count;) {
+                ReadStatus status = kStatusOk;
+                try {
+                    if ((status = segment.Seek(index)) == kStatusOk) {
+                        status = decode(index, &segment);
+                    }
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    error = error ? error : std::current_exception();
+                    stop = true;
+                    return;
+                }
+                if (status != kStatusOk) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (index < failed) {
+                        failed = index;
+                        result = status;
+                    }
+                    stop = true;
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (int i = 1; i < threads; ++i) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : pool) {
+            thread.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return result;
+    }
+
+    /* Number of records in the index, -1 if the stream has none or the source cannot seek */
+    int64_t RecordCount() {
+        if (!index_loaded_ && (header_status_ != kStatusOk || LoadIndex() != kStatusOk)) {
+            return -1;
+        }
+        return record_offsets_.size();
+    }
+
+    /* Vectors, maps and strings longer than `bytes` are rejected with kStatusLimitExceeded before allocating */
+    void SetMaxAllocation(uint64_t bytes) {
+        max_allocation_ = bytes;
+    }
+
     template <class T>
     bool RegisterClass(const std::string& str) {
         auto type_index = std::type_index(typeid(std::decay_t<T>));
@@ -47,47 +230,158 @@ public:
             return false;
         }
         registered_classes_[type_index] = str;
+        registered_names_[str] = &typeid(std::decay_t<T>);
         return true;
     }
 
+    template <class T>
+    bool RegisterClass() {
+        return RegisterClass<T>(StructFields<std::decay_t<T>>::kName);
+    }
+
     template <class T>
     ReadStatus TryRead(T* object) {
-        if (corrupted_) {
-            return kStatusReadError;
+        OOSF_STATS(StatsScope stats_scope(this);)
+        return TryReadValue(object);
+    }
+
+    /* Vectors may also come chunked, integer ones bit-packed and floating point ones XOR-compressed */
+    template <class T, class... Args>
+    ReadStatus TryRead(std::vector<T, Args...>* vec) {
+        OOSF_STATS(StatsScope stats_scope(this);)
+        if constexpr (HasStructFields<T>::value) {
+            if (!corrupted_ && PeekByte() == TYPE_COLUMNAR_VECTOR) {
+                return TryReadColumnarStructs(vec);
+            }
         }
-        ReadStatus result = kStatusOk;
-        if ((result = CheckType(object)) == kStatusOk) {
-            result = ReadObject(object);
+        if (!corrupted_ && PeekByte() == TYPE_CHUNKED_VECTOR) {
+            return TryReadChunked(vec);
         }
-        return result;
+        if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+            if (!corrupted_ && PeekByte() == TYPE_PACKED_VECTOR) {
+                return TryReadPacked(vec);
+            }
+        }
+        if constexpr (std::is_floating_point_v<T>) {
+            if (!corrupted_ && PeekByte() == TYPE_XOR_VECTOR) {
+                return TryReadCompressed(vec);
+            }
+        }
+        return TryReadValue(vec);
+    }
+
+    /* Column by column decoding of a columnar vector of structs; arithmetic columns are copied in bulk */
+    template <class T>
+    ReadStatus TryRead(StructColumns<T>* columns) {
+        OOSF_STATS(StatsScope stats_scope(this);)
+        int64_t length = 0;
+        if (ReadStatus status = ReadColumnarHeader<T>(&length); status != kStatusOk) {
+            return status;
+        }
+        ReadStatus status = kStatusOk;
+        std::apply([&](auto&... column) {
+            ((status = status == kStatusOk ? ReadElements(&column, 0, length) : status), ...);
+        }, columns->AllColumns());
+        return status;
+    }
+
+    /* Maps may also come chunked or columnar; any encoding can be read into any of the map types */
+    template <class K, class V, class... Args>
+    ReadStatus TryRead(std::map<K, V, Args...>* map) {
+        OOSF_STATS(StatsScope stats_scope(this);)
+        return TryReadMap<K, V>(map);
+    }
+
+    template <class K, class V, class... Args>
+    ReadStatus TryRead(std::unordered_map<K, V, Args...>* map) {
+        OOSF_STATS(StatsScope stats_scope(this);)
+        return TryReadMap<K, V>(map);
+    }
+
+    template <class K, class V, class... Args>
+    ReadStatus TryRead(FlatMap<K, V, Args...>* map) {
+        OOSF_STATS(StatsScope stats_scope(this);)
+        return TryReadMap<K, V>(map);
     }
 
     ReadStatus TryRead(bool* var) {
         if (corrupted_) {
             return kStatusReadError;
         }
-        auto pos = std::ftell(file_);
-        int sym1 = GetByte();
-        if (sym1 < 0) {
-            std::fseek(file_, pos, SEEK_SET);
+        OOSF_STATS(StatsScope stats_scope(this);)
+        int64_t pin = Pin();
+        ReadStatus result = ReadBool(var);
+        Unpin(pin);
+        return result;
+    }
+
+    /*
+     * Opens a vector for element by element decoding. Elements are read on demand, so memory does not depend
+     * on the vector length; nothing else may be read from the stream until the cursor is closed or destroyed,
+     * which skips the elements left.
+     */
+    template <class T>
+    ReadStatus OpenVector(VectorCursor<T>* cursor) {
+        cursor->Close();
+        if (corrupted_) {
             return kStatusReadError;
         }
-        if (sym1 == '+' || sym1 == '-') {
-            *var = sym1 == '+';
-            return kStatusOk;
+        bool packed = false;
+        bool chunked = PeekByte() == TYPE_CHUNKED_VECTOR;
+        int64_t length = 0;
+        ReadStatus status = kStatusOk;
+        if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+            packed = PeekByte() == TYPE_PACKED_VECTOR;
         }
-        if (sym1 == '?') {
-            int sym2 = GetByte();
-            if (sym2 < 0) {
-                std::fseek(file_, pos, SEEK_SET);
-                return kStatusReadError;
+        bool framed = false;
+        if (packed) {
+            status = ReadPackedHeader<T>(&length);
+        } else if (chunked) {
+            status = CheckTaggedType<T>();
+        } else {
+            int64_t pin = Pin();
+            status = CheckType(static_cast<std::vector<T>*>(nullptr));
+            Unpin(pin);
+            if (status == kStatusOk) {
+                status = OpenFrame(&framed);
             }
-            *var = sym2;
-            return kStatusOk;
+            if (status == kStatusOk) {
+                status = ReadContainerLength(&length);
+            }
+        }
+        if (status == kStatusOk) {
+            cursor->Open(this, length, packed, chunked, framed);
+        } else if (framed) {
+            EndFrame(status);
         }
+        return status;
+    }
 
-        std::fseek(file_, pos, SEEK_SET);
-        return kStatusBadType;
+    template <class K, class V>
+    ReadStatus OpenMap(MapCursor<K, V>* cursor) {
+        cursor->Close();
+        if (corrupted_) {
+            return kStatusReadError;
+        }
+        if (PeekByte() == TYPE_CHUNKED_MAP) {
+            ReadStatus status = CheckTaggedType<K, V>();
+            if (status == kStatusOk) {
+                cursor->Open(this, 0, true, false);
+            }
+            return status;
+        }
+        int64_t pin = Pin();
+        ReadStatus status = CheckType(static_cast<std::map<K, V>*>(nullptr));
+        Unpin(pin);
+        int64_t length = 0;
+        bool framed = false;
+        if (status == kStatusOk && (status = OpenFrame(&framed)) == kStatusOk &&
+                (status = ReadContainerLength(&length)) == kStatusOk) {
+            cursor->Open(this, length, false, framed);
+        } else if (framed) {
+            EndFrame(status);
+        }
+        return status;
     }
 
     ReadStatus TryReadMinimal(int64_t* value) {
@@ -111,247 +405,2714 @@ public:
 #undef TRY_READ
     }
 
-private:
-#define CHECK_FIRST_LETTER(symbol) {                                    \
-    char ch = GetByte();                                                \
-    /*LOG(ch);*/                                                        \
-    if (ch != symbol) {                                                 \
-        if (ch < 0 || std::fseek(file_, pos, SEEK_SET) < 0) {           \
-            corrupted_ = true;                                          \
-            return kStatusReadError;                                    \
-        }                                                               \
-        return kStatusBadType;                                          \
-    }                                                                   \
-}
-    template <class T>
-    ReadStatus CheckType(T*) {
-        if constexpr (std::is_base_of_v<Serializable, std::decay_t<T>>) {
-            auto pos = std::ftell(file_);
-            CHECK_FIRST_LETTER(TYPE_STRUCT);
+    /*
+     * Skips the next value whatever its type, keeping the string cache and class table in step. In framed
+     * streams (kFlagFramedValues) structs, vectors, maps and tuples are jumped over whole; otherwise the value
+     * is walked by its type tags. Struct payloads cannot be walked, so without frames skipping one fails with
+     * kStatusUnsupported and leaves the stream at the value.
+     */
+    ReadStatus SkipValue() {
+        if (corrupted_) {
+            return kStatusReadError;
+        }
+        OOSF_STATS(StatsScope stats_scope(this);)
+        auto pos = Tell();
+        int64_t pin = Pin();
+        skip_types_.clear();
+        skip_class_names_.clear();
+        ReadStatus status = ReadSkipHeader();
+        Unpin(pin);
+        if (status == kStatusBadType || status == kStatusUnsupported) {
+            Rewind(pos);
+            return status;
+        }
+        if (status == kStatusOk) {
+            status = SkipBody();
+        }
+        if (status != kStatusOk) {
+            corrupted_ = true;
+        }
+        return status;
+    }
 
-            String str;
-            ReadStatus string_check = ReadString(&str);
-            if (string_check != kStatusOk) {
-                std::fseek(file_, pos, SEEK_SET);
-                return string_check;
+    /*
+     * Walks the next value by its type tags and reports it to `visitor` instead of decoding it, keeping the
+     * string cache and class table in step. A record start is reported as OnRecord() and begins the record; the
+     * index at the end of a stream is kStatusBadType. As with SkipValue(), struct payloads can only be walked
+     * in framed streams; otherwise the value fails with kStatusUnsupported before anything is reported.
+     */
+    ReadStatus VisitValue(ValueVisitor* visitor) {
+        if (corrupted_) {
+            return kStatusReadError;
+        }
+        OOSF_STATS(StatsScope stats_scope(this);)
+        if (PeekByte() == TYPE_RECORD) {
+            ReadStatus status = BeginRecord();
+            if (status == kStatusOk) {
+                visitor->OnRecord();
             }
+            return status;
+        }
+        skip_types_.clear();
+        skip_class_names_.clear();
+        return VisitTagged(visitor);
+    }
 
-            auto type_index = std::type_index(typeid(std::decay_t<T>));
-            auto iter = registered_classes_.find(type_index);
-            if (iter == registered_classes_.end() || iter->second != str.get()) {
-                std::fseek(file_, pos, SEEK_SET);
-                return kStatusBadType;
-            }
+    /*
+     * For Serializable::TryRead in framed streams: whether the struct being read has fields left, so fields
+     * added by newer writers can be read only when present. Always true without frames.
+     */
+    bool HasMoreFields() {
+        return frames_.empty() || Tell() < frames_.back().end;
+    }
 
-            UpdateStringCache(&str);
-            return kStatusOk;
+private:
+    static constexpr size_t kBufferSize = 1 << 16;
 
-        } else {
-            return kStatusBadType;
-        }
+    /* Stream over the same data as `parent` for decoding its records on another thread */
+    InputDataStream(InputSource* source, const InputDataStream& parent)
+        : source_(source), max_allocation_(parent.max_allocation_), shared_dictionary_(parent.shared_dictionary_),
+          record_offsets_(parent.record_offsets_), index_loaded_(true),
+          registered_classes_(parent.registered_classes_), registered_names_(parent.registered_names_) {
+        ReadHeader();
     }
 
-
-#define CHECK_SIMPLE_TYPE(type, symbol)                                 \
-        ReadStatus CheckType(type*) {                                   \
-            auto pos = std::ftell(file_);                               \
-            CHECK_FIRST_LETTER(symbol)                                  \
-            return kStatusOk;                                           \
+    template <class T>
+    ReadStatus TryReadValue(T* object) {
+        if (corrupted_) {
+            return kStatusReadError;
         }
-
-#define READ_SIMPLE_TYPE(type)                                          \
-        ReadStatus ReadObject(type* value) {                            \
-            uint32_t items = std::fread(value, sizeof(type), 1, file_); \
-            return items == 0 ?                                         \
-                    (corrupted_ = true, kStatusReadError) : kStatusOk;  \
+        int64_t pin = Pin();
+        ReadStatus result = CheckType(object);
+        Unpin(pin);
+        if (result == kStatusOk) {
+            if constexpr (IsComposite<T>::value) {
+                result = ReadFramed([this, object] { return ReadObject(object); });
+            } else {
+                result = ReadObject(object);
+            }
         }
+        return result;
+    }
 
-#define READ_CHECK(type, symbol) CHECK_SIMPLE_TYPE(type, symbol) READ_SIMPLE_TYPE(type)
-
-    READ_CHECK(int8_t   , TYPE_INT8     )
-    READ_CHECK(int16_t  , TYPE_INT16    )
-    READ_CHECK(int32_t  , TYPE_INT32    )
-    READ_CHECK(int64_t  , TYPE_INT64    )
-    READ_CHECK(double   , TYPE_DOUBLE   )
-    READ_CHECK(float    , TYPE_FLOAT    )
-    READ_CHECK(bool     , TYPE_BOOL     )
+    /* Values written with a 'v', 'm' or 't' type header; in framed streams a frame follows the header */
+    template <class T>
+    class IsComposite : public std::false_type {};
 
-    CHECK_SIMPLE_TYPE(String, TYPE_STRING)
-    CHECK_SIMPLE_TYPE(std::string, TYPE_STRING)
+    template <class T, class... Args>
+    class IsComposite<std::vector<T, Args...>> : public std::true_type {};
 
-#undef READ_CHECK
-#undef CHECK_SIMPLE_TYPE
-#undef READ_SIMPLE_TYPE
+    template <class T, size_t N>
+    class IsComposite<std::array<T, N>> : public std::true_type {};
 
-#define CHECK_SUBTYPE(type) {                           \
-    ReadStatus inner_check = CheckType((type*)nullptr); \
-    if (inner_check != kStatusOk) {                     \
-        std::fseek(file_, pos, SEEK_SET);               \
-        return inner_check;                             \
-    }                                                   \
-}
-    template <class T, class... Args>
-    ReadStatus CheckType(std::vector<T, Args...>*) {
-        auto pos = std::ftell(file_);
-        CHECK_FIRST_LETTER(TYPE_VECTOR)
-        CHECK_SUBTYPE(T)
-        return kStatusOk;
-    }
+    template <class T>
+    class IsComposite<VectorView<T>> : public std::true_type {};
 
     template <class K, class V, class... Args>
-    ReadStatus CheckType(std::map<K, V, Args...>*) {
-        auto pos = std::ftell(file_);
-        CHECK_FIRST_LETTER(TYPE_MAP)
-        CHECK_SUBTYPE(K)
-        CHECK_SUBTYPE(V)
-        return kStatusOk;
-    }
+    class IsComposite<std::map<K, V, Args...>> : public std::true_type {};
 
     template <class K, class V, class... Args>
-    ReadStatus CheckType(std::unordered_map<K, V, Args...>*) {
-        return CheckType(static_cast<std::map<K, V>*>(nullptr));
-    }
+    class IsComposite<std::unordered_map<K, V, Args...>> : public std::true_type {};
 
-#define READ_LENGTH                                                                 \
-int64_t length = 0;                                                                 \
-ReadStatus status = kStatusOk;                                                      \
-if ((status = TryReadMinimal(&length)) != kStatusOk) {                              \
-    corrupted_ = true;                                                              \
-    return status == kStatusReadError ? kStatusReadError : kStatusMalformedData;    \
-}
+    template <class K, class V, class... Args>
+    class IsComposite<FlatMap<K, V, Args...>> : public std::true_type {};
 
+    template <class... Args>
+    class IsComposite<std::tuple<Args...>> : public std::true_type {};
 
-//         template <class... Args>
-//         ReadStatus CheckType(std::tuple<Args...>*) {
-//             return kStatusBadType; /* TODO fix */
-//             auto pos = std::ftell(file_);
-//             CHECK_FIRST_LETTER(TYPE_TUPLE)
-//             READ_LENGTH
-//             if (length != sizeof...(Args)) {
-//                 corrupted_ = true;
-//                 return kStatusMalformedData;
-//             }
-//
-//             return kStatusOk;
-//         }
+    template <class First, class Second>
+    class IsComposite<std::pair<First, Second>> : public std::true_type {};
 
-#undef CHECK_SUBTYPE
-#undef CHECK_FIRST_LETTER
+    /* An open frame: where it ends, how many classes were declared before it and how many strings inside it */
+    struct Frame {
+        int64_t end;
+        size_t classes;
+        int strings = 0;
+    };
 
-    template <class T, class=std::enable_if_t<std::is_base_of_v<Serializable, std::decay_t<T>>>>
-    ReadStatus ReadObject(T* obj) {
-        return obj->TryRead(this);
+    template <class Read>
+    ReadStatus ReadFramed(Read read) {
+        if (!(flags_ & kFlagFramedValues)) {
+            return read();
+        }
+        if (ReadStatus status = BeginFrame(); status != kStatusOk) {
+            return status;
+        }
+        return EndFrame(read());
     }
 
-    ReadStatus ReadObject(std::string* str) {
-        String buf;
-        ReadStatus status = ReadObject(&buf);
-        if (status == kStatusOk) {
-            *str = buf.get();
+    /* Cursors keep the frame of their container open until they are closed */
+    ReadStatus OpenFrame(bool* framed) {
+        if (!(flags_ & kFlagFramedValues)) {
+            return kStatusOk;
         }
+        ReadStatus status = BeginFrame();
+        *framed = status == kStatusOk;
         return status;
     }
 
-    template <class T, class... Args>
-    ReadStatus ReadObject(std::vector<T, Args...>* vec) {
-        READ_LENGTH
-        if (length < 0) {
+    ReadStatus BeginFrame() {
+        uint32_t size = 0;
+        if (!ReadBytes(&size, sizeof(size))) {
+            corrupted_ = true;
+            return kStatusReadError;
+        }
+        if (source_->Data() && size > static_cast<uint64_t>(end_ - cur_)) {
             corrupted_ = true;
             return kStatusMalformedData;
         }
-        vec->resize(length);
+        frames_.push_back({Tell() + size, class_table_.size()});
+        return kStatusOk;
+    }
 
-        for (int i = 0; i < length; ++i) {
-            if (ReadStatus status = ReadObject(&vec->at(i)); status != kStatusOk) {
-                corrupted_ = true;
-                return status;
-            }
+    /* Whatever the reader left of the frame, such as fields added by a newer writer, is jumped over */
+    ReadStatus EndFrame(ReadStatus status) {
+        Frame frame = frames_.back();
+        frames_.pop_back();
+        class_table_.erase(class_table_.begin() + frame.classes, class_table_.end());
+        if (status != kStatusOk) {
+            return status;
+        }
+        int64_t pos = Tell();
+        if (pos > frame.end) {
+            corrupted_ = true;
+            return kStatusMalformedData;
+        }
+        if (pos < frame.end && !SkipBytes(frame.end - pos)) {
+            corrupted_ = true;
+            return kStatusReadError;
         }
         return kStatusOk;
     }
 
-    template <class K, class V, class... Args>
-    ReadStatus ReadObject(std::map<K, V, Args...>* map) {
-        return ReadAsMap<K, V>(map);
-    }
+    /* Type header of a value being skipped, flattened in prefix order */
+    struct SkipType {
+        int tag;
+        /* Elements of a tuple, fields of a columnar vector, class of a struct (see ReadSkipClass) */
+        int64_t arity;
+        /* Index after the subtree */
+        size_t end;
+    };
 
-    template <class K, class V, class... Args>
-    ReadStatus ReadObject(std::unordered_map<K, V, Args...>* map) {
-        return ReadAsMap<K, V>(map);
+    static constexpr int kMaxSkipDepth = 64;
+
+    /*
+     * Appends the nodes of the next type header to skip_types_, the value's own node first. OOSFv1 class names
+     * are cached once the whole header has been read.
+     */
+    ReadStatus ReadSkipHeader() {
+        size_t base = skip_types_.size();
+        skip_names_.clear();
+        ReadStatus status = ReadSkipNodes(base);
+        if (status == kStatusOk) {
+            for (const CachedString& name : skip_names_) {
+                UpdateStringCache(name);
+            }
+        }
+        return status;
     }
 
-    template <class K, class V, class Map>
-    ReadStatus ReadAsMap(Map* map) {
-        READ_LENGTH
+    ReadStatus ReadSkipNodes(size_t base) {
+        int tag = PeekByte();
+        ReadStatus status = kStatusOk;
+        switch (tag) {
+        case TYPE_BOOL:
+        case TYPE_BOOL_T:
+        case TYPE_BOOL_F:
+        case TYPE_RECORD:
+        case TYPE_INDEX:
+            GetByte();
+            skip_types_.push_back({tag, 0, 1});
+            return tag == TYPE_RECORD || tag == TYPE_INDEX ? kStatusBadType : kStatusOk;
+        case TYPE_PACKED_VECTOR:
+        case TYPE_XOR_VECTOR:
+        case TYPE_CHUNKED_VECTOR:
+        case TYPE_CHUNKED_MAP:
+        case TYPE_COLUMNAR_MAP:
+            GetByte();
+            skip_types_.push_back({tag, 0, 0});
+            status = ReadSkipType(true, 1);
+            if (status == kStatusOk && (tag == TYPE_CHUNKED_MAP || tag == TYPE_COLUMNAR_MAP)) {
+                status = ReadSkipType(true, 1);
+            }
+            break;
+        case TYPE_COLUMNAR_VECTOR: {
+            GetByte();
+            skip_types_.push_back({tag, 0, 0});
+            int64_t count = 0;
+            if ((status = ReadSkipType(false, 1)) != kStatusOk) {
+                break;
+            }
+            if ((status = TryReadMinimal(&count)) != kStatusOk || count < 0) {
+                return status == kStatusReadError ? kStatusReadError : kStatusMalformedData;
+            }
+            skip_types_[base].arity = count;
+            for (int64_t i = 0; i < count && status == kStatusOk; ++i) {
+                status = ReadSkipType(true, 1);
+            }
+            break;
+        }
+        case -1:
+            return kStatusReadError;
+        default:
+            return ReadSkipType(true, 0);
+        }
+        skip_types_[base].end = skip_types_.size();
+        return status;
+    }
+
+    /* One type of a header; `payload` tells whether values of it follow, which structs only do in frames */
+    ReadStatus ReadSkipType(bool payload, int depth) {
+        if (depth > kMaxSkipDepth) {
+            return kStatusMalformedData;
+        }
+        int tag = GetByte();
+        size_t index = skip_types_.size();
+        skip_types_.push_back({tag, 0, 0});
+        ReadStatus status = kStatusOk;
+        switch (tag) {
+        case TYPE_INT8:
+        case TYPE_INT16:
+        case TYPE_INT32:
+        case TYPE_INT64:
+        case TYPE_FLOAT:
+        case TYPE_DOUBLE:
+        case TYPE_STRING:
+            break;
+        case TYPE_VECTOR:
+            status = ReadSkipType(payload, depth + 1);
+            break;
+        case TYPE_MAP:
+            if ((status = ReadSkipType(payload, depth + 1)) == kStatusOk) {
+                status = ReadSkipType(payload, depth + 1);
+            }
+            break;
+        case TYPE_TUPLE: {
+            int64_t arity = 0;
+            if ((status = TryReadMinimal(&arity)) != kStatusOk || arity < 0) {
+                return status == kStatusReadError ? kStatusReadError : kStatusMalformedData;
+            }
+            skip_types_[index].arity = arity;
+            for (int64_t i = 0; i < arity && status == kStatusOk; ++i) {
+                status = ReadSkipType(payload, depth + 1);
+            }
+            break;
+        }
+        case TYPE_STRUCT:
+            status = payload && !(flags_ & kFlagFramedValues) ? kStatusUnsupported : ReadSkipClass(index);
+            break;
+        case -1:
+            return kStatusReadError;
+        default:
+            return kStatusMalformedData;
+        }
+        skip_types_[index].end = skip_types_.size();
+        return status;
+    }
+
+    /*
+     * The node's arity names the class: its id, or in OOSFv1 an index into skip_class_names_. OOSFv1 names are
+     * only cached once the whole header is known to be skippable.
+     */
+    ReadStatus ReadSkipClass(size_t index) {
+        if (version_ != kFormatV1) {
+            uint64_t code = 0;
+            if (!ReadVarint(&code)) {
+                return kStatusReadError;
+            }
+            skip_types_[index].arity = code >> 1;
+            if (code & 1) {
+                return ReadClassDeclaration(code >> 1);
+            }
+            return (code >> 1) < class_table_.size() ? kStatusOk : kStatusMalformedData;
+        }
+        CachedString name;
+        ReadStatus status = ReadString(&name);
+        if (status == kStatusOk) {
+            /* The rest of the header may refill the buffer the name points into */
+            if (!source_->Data() && !name.owner) {
+                name.owner = MakeString(name.view);
+                name.view = std::string_view(name.owner.get(), name.view.size());
+            }
+            skip_names_.push_back(name);
+            skip_types_[index].arity = skip_class_names_.size();
+            skip_class_names_.emplace_back(name.view);
+        }
+        return status;
+    }
+
+    std::string_view SkipClassName(size_t node) const {
+        size_t id = skip_types_[node].arity;
+        return version_ == kFormatV1 ? std::string_view(skip_class_names_[id]) : class_table_[id].name;
+    }
+
+    ReadStatus SkipBody() {
+        int tag = skip_types_[0].tag;
+        int64_t length = 0;
+        ReadStatus status = kStatusOk;
+        switch (tag) {
+        case TYPE_BOOL_T:
+        case TYPE_BOOL_F:
+            return kStatusOk;
+        case TYPE_BOOL:
+            return SkipFixed(1);
+        case TYPE_PACKED_VECTOR:
+            return SkipPacked();
+        case TYPE_XOR_VECTOR: {
+            int64_t bytes = 0;
+            if ((status = ReadContainerLength(&length)) != kStatusOk ||
+                    (status = ReadContainerLength(&bytes)) != kStatusOk) {
+                return status;
+            }
+            return SkipFixed(bytes);
+        }
+        case TYPE_CHUNKED_VECTOR:
+        case TYPE_CHUNKED_MAP:
+            while ((status = ReadContainerLength(&length)) == kStatusOk && length > 0) {
+                status = tag == TYPE_CHUNKED_MAP ? SkipEntries(1, length) : SkipElements(1, length);
+                if (status != kStatusOk) {
+                    break;
+                }
+            }
+            return status;
+        case TYPE_COLUMNAR_MAP:
+            if ((status = ReadContainerLength(&length)) != kStatusOk ||
+                    (status = SkipElements(1, length)) != kStatusOk) {
+                return status;
+            }
+            return SkipElements(skip_types_[1].end, length);
+        case TYPE_COLUMNAR_VECTOR: {
+            if ((status = ReadContainerLength(&length)) != kStatusOk) {
+                return status;
+            }
+            size_t node = skip_types_[1].end;
+            for (int64_t i = 0; i < skip_types_[0].arity && status == kStatusOk; ++i) {
+                status = SkipElements(node, length);
+                node = skip_types_[node].end;
+            }
+            return status;
+        }
+        case TYPE_VECTOR:
+        case TYPE_MAP:
+        case TYPE_TUPLE:
+            if (flags_ & kFlagFramedValues) {
+                return SkipFrame();
+            }
+            return SkipPayload(0);
+        default:
+            return SkipPayload(0);
+        }
+    }
+
+    /* Bytes of every value of the type, 0 if they vary */
+    int64_t FixedSize(size_t node) const {
+        bool varint = flags_ & kFlagVarintIntegers;
+        switch (skip_types_[node].tag) {
+        case TYPE_INT8:
+            return 1;
+        case TYPE_INT16:
+            return varint ? 0 : 2;
+        case TYPE_INT32:
+            return varint ? 0 : 4;
+        case TYPE_INT64:
+            return varint ? 0 : 8;
+        case TYPE_FLOAT:
+            return 4;
+        case TYPE_DOUBLE:
+            return 8;
+        default:
+            return 0;
+        }
+    }
+
+    /* One value of the type at skip_types_[node], as found inside containers and structs */
+    ReadStatus SkipPayload(size_t node) {
+        if (int64_t size = FixedSize(node); size > 0) {
+            return SkipFixed(size);
+        }
+        const SkipType& type = skip_types_[node];
+        int64_t length = 0;
+        ReadStatus status = kStatusOk;
+        switch (type.tag) {
+        case TYPE_INT16:
+        case TYPE_INT32:
+        case TYPE_INT64: {
+            uint64_t value = 0;
+            return ReadVarint(&value) ? kStatusOk : kStatusReadError;
+        }
+        case TYPE_STRING: {
+            CachedString str;
+            if ((status = ReadString(&str)) == kStatusOk) {
+                UpdateStringCache(str);
+            }
+            return status;
+        }
+        case TYPE_VECTOR:
+            if ((status = ReadContainerLength(&length)) != kStatusOk) {
+                return status;
+            }
+            return SkipElements(node + 1, length);
+        case TYPE_MAP:
+            if ((status = ReadContainerLength(&length)) != kStatusOk) {
+                return status;
+            }
+            return SkipEntries(node + 1, length);
+        case TYPE_TUPLE: {
+            size_t element = node + 1;
+            for (int64_t i = 0; i < type.arity && status == kStatusOk; ++i) {
+                status = SkipPayload(element);
+                element = skip_types_[element].end;
+            }
+            return status;
+        }
+        case TYPE_STRUCT:
+            return SkipFrame();
+        default:
+            return kStatusMalformedData;
+        }
+    }
+
+    /* Runs of fixed size values are skipped at once */
+    ReadStatus SkipElements(size_t node, int64_t count) {
+        if (int64_t size = FixedSize(node); size > 0) {
+            if (count > INT64_MAX / size) {
+                return kStatusMalformedData;
+            }
+            return SkipFixed(count * size);
+        }
+        ReadStatus status = kStatusOk;
+        for (int64_t i = 0; i < count && status == kStatusOk; ++i) {
+            status = SkipPayload(node);
+        }
+        return status;
+    }
+
+    /* Map entries whose key type is at skip_types_[node] */
+    ReadStatus SkipEntries(size_t node, int64_t count) {
+        ReadStatus status = kStatusOk;
+        for (int64_t i = 0; i < count && status == kStatusOk; ++i) {
+            if ((status = SkipPayload(node)) == kStatusOk) {
+                status = SkipPayload(skip_types_[node].end);
+            }
+        }
+        return status;
+    }
+
+    ReadStatus SkipPacked() {
+        int64_t length = 0;
+        if (ReadStatus status = ReadContainerLength(&length); status != kStatusOk) {
+            return status;
+        }
+        for (int64_t blocks = length / PackedVectorCodec::kBlockSize; blocks > 0; --blocks) {
+            if (!Fill(1) || !Fill(PackedVectorCodec::BlockBytes(*cur_))) {
+                return kStatusReadError;
+            }
+            if ((*cur_ & 0x7f) > 64) {
+                return kStatusMalformedData;
+            }
+            cur_ += PackedVectorCodec::BlockBytes(*cur_);
+        }
+        for (int64_t tail = length % PackedVectorCodec::kBlockSize; tail > 0; --tail) {
+            uint64_t delta = 0;
+            if (!ReadVarint(&delta)) {
+                return kStatusReadError;
+            }
+        }
+        return kStatusOk;
+    }
+
+    ReadStatus SkipFrame() {
+        uint32_t size = 0;
+        if (!ReadBytes(&size, sizeof(size))) {
+            return kStatusReadError;
+        }
+        return SkipFixed(size);
+    }
+
+    ReadStatus SkipFixed(uint64_t bytes) {
+        return SkipBytes(bytes) ? kStatusOk : kStatusReadError;
+    }
+
+    /* A value with its type header; the header's nodes are dropped again afterwards, so fields may nest */
+    ReadStatus VisitTagged(ValueVisitor* visitor) {
+        size_t base = skip_types_.size();
+        auto pos = Tell();
+        int64_t pin = Pin();
+        ReadStatus status = ReadSkipHeader();
+        Unpin(pin);
+        if (status == kStatusBadType || status == kStatusUnsupported) {
+            skip_types_.resize(base);
+            Rewind(pos);
+            return status;
+        }
+        if (status == kStatusOk) {
+            int tag = skip_types_[base].tag;
+            if ((tag == TYPE_VECTOR || tag == TYPE_MAP || tag == TYPE_TUPLE) && (flags_ & kFlagFramedValues)) {
+                status = ReadFramed([this, base, visitor] { return Visit(base, visitor); });
+            } else {
+                status = Visit(base, visitor);
+            }
+        }
+        skip_types_.resize(base);
+        if (status != kStatusOk) {
+            corrupted_ = true;
+        }
+        return status;
+    }
+
+    using VisitHandler = ReadStatus (InputDataStream::*)(size_t node, ValueVisitor* visitor);
+
+    /*
+     * Handlers by tag byte. Plain types visit one payload of the type at skip_types_[node]; the special
+     * encodings, which only appear as whole values, visit their body.
+     */
+    static const std::array<VisitHandler, 256>& VisitTable() {
+        static const std::array<VisitHandler, 256> table = [] {
+            std::array<VisitHandler, 256> handlers;
+            handlers.fill(&InputDataStream::VisitMalformed);
+            handlers[TYPE_INT8] = &InputDataStream::VisitInteger<int8_t>;
+            handlers[TYPE_INT16] = &InputDataStream::VisitInteger<int16_t>;
+            handlers[TYPE_INT32] = &InputDataStream::VisitInteger<int32_t>;
+            handlers[TYPE_INT64] = &InputDataStream::VisitInteger<int64_t>;
+            handlers[TYPE_FLOAT] = &InputDataStream::VisitFloat<float>;
+            handlers[TYPE_DOUBLE] = &InputDataStream::VisitFloat<double>;
+            handlers[TYPE_STRING] = &InputDataStream::VisitString;
+            handlers[TYPE_VECTOR] = &InputDataStream::VisitVector;
+            handlers[TYPE_MAP] = &InputDataStream::VisitMap;
+            handlers[TYPE_TUPLE] = &InputDataStream::VisitTuple;
+            handlers[TYPE_STRUCT] = &InputDataStream::VisitStruct;
+            handlers[TYPE_BOOL] = &InputDataStream::VisitBool;
+            handlers[TYPE_BOOL_T] = &InputDataStream::VisitBool;
+            handlers[TYPE_BOOL_F] = &InputDataStream::VisitBool;
+            handlers[TYPE_PACKED_VECTOR] = &InputDataStream::VisitPacked;
+            handlers[TYPE_XOR_VECTOR] = &InputDataStream::VisitXor;
+            handlers[TYPE_CHUNKED_VECTOR] = &InputDataStream::VisitChunked;
+            handlers[TYPE_CHUNKED_MAP] = &InputDataStream::VisitChunked;
+            handlers[TYPE_COLUMNAR_MAP] = &InputDataStream::VisitColumns;
+            handlers[TYPE_COLUMNAR_VECTOR] = &InputDataStream::VisitColumns;
+            return handlers;
+        }();
+        return table;
+    }
+
+    ReadStatus Visit(size_t node, ValueVisitor* visitor) {
+        return (this->*VisitTable()[skip_types_[node].tag])(node, visitor);
+    }
+
+    ReadStatus VisitMalformed(size_t, ValueVisitor*) {
+        return kStatusMalformedData;
+    }
+
+    template <class T>
+    ReadStatus VisitInteger(size_t node, ValueVisitor* visitor) {
+        T value = 0;
+        ReadStatus status = ReadInteger(&value);
+        if (status == kStatusOk) {
+            visitor->OnInt(value, skip_types_[node].tag);
+        }
+        return status;
+    }
+
+    template <class T>
+    ReadStatus VisitFloat(size_t node, ValueVisitor* visitor) {
+        T value = 0;
+        if (!ReadBytes(&value, sizeof(T))) {
+            return kStatusReadError;
+        }
+        visitor->OnFloat(value, skip_types_[node].tag);
+        return kStatusOk;
+    }
+
+    ReadStatus VisitString(size_t, ValueVisitor* visitor) {
+        CachedString str;
+        ReadStatus status = ReadString(&str);
+        if (status == kStatusOk) {
+            visitor->OnString(str.view);
+            UpdateStringCache(str);
+        }
+        return status;
+    }
+
+    ReadStatus VisitBool(size_t node, ValueVisitor* visitor) {
+        int tag = skip_types_[node].tag;
+        if (tag != TYPE_BOOL) {
+            visitor->OnBool(tag == TYPE_BOOL_T);
+            return kStatusOk;
+        }
+        int value = GetByte();
+        if (value < 0) {
+            return kStatusReadError;
+        }
+        visitor->OnBool(value != 0);
+        return kStatusOk;
+    }
+
+    ReadStatus VisitVector(size_t node, ValueVisitor* visitor) {
+        int64_t length = 0;
+        if (ReadStatus status = ReadContainerLength(&length); status != kStatusOk) {
+            return status;
+        }
+        visitor->BeginVector(length);
+        ReadStatus status = VisitElements(node + 1, length, visitor);
+        if (status == kStatusOk) {
+            visitor->EndVector();
+        }
+        return status;
+    }
+
+    ReadStatus VisitMap(size_t node, ValueVisitor* visitor) {
+        int64_t length = 0;
+        if (ReadStatus status = ReadContainerLength(&length); status != kStatusOk) {
+            return status;
+        }
+        visitor->BeginMap(length);
+        ReadStatus status = VisitEntries(node + 1, length, visitor);
+        if (status == kStatusOk) {
+            visitor->EndMap();
+        }
+        return status;
+    }
+
+    ReadStatus VisitTuple(size_t node, ValueVisitor* visitor) {
+        int64_t arity = skip_types_[node].arity;
+        visitor->BeginTuple(arity);
+        ReadStatus status = kStatusOk;
+        size_t element = node + 1;
+        for (int64_t i = 0; i < arity && status == kStatusOk; ++i) {
+            status = Visit(element, visitor);
+            element = skip_types_[element].end;
+        }
+        if (status == kStatusOk) {
+            visitor->EndTuple();
+        }
+        return status;
+    }
+
+    /* The header only lets structs through in framed streams, where the frame tells where the fields end */
+    ReadStatus VisitStruct(size_t node, ValueVisitor* visitor) {
+        if (ReadStatus status = BeginFrame(); status != kStatusOk) {
+            return status;
+        }
+        visitor->BeginStruct(SkipClassName(node));
+        ReadStatus status = kStatusOk;
+        while (status == kStatusOk && Tell() < frames_.back().end) {
+            status = VisitTagged(visitor);
+        }
+        if (status == kStatusOk) {
+            visitor->EndStruct();
+        }
+        return EndFrame(status);
+    }
+
+    /* Runs of fixed size values go out as they lie in the buffer */
+    ReadStatus VisitElements(size_t node, int64_t count, ValueVisitor* visitor) {
+        if (int64_t size = FixedSize(node); size > 0) {
+            if (count > INT64_MAX / size) {
+                return kStatusMalformedData;
+            }
+            int tag = skip_types_[node].tag;
+            int64_t run = source_->Data() ? count : std::max<int64_t>(1, kBufferSize / size);
+            while (count > 0) {
+                int64_t step = std::min(count, run);
+                if (!Fill(step * size)) {
+                    return kStatusReadError;
+                }
+                visitor->OnValues(tag, cur_, step);
+                cur_ += step * size;
+                count -= step;
+            }
+            return kStatusOk;
+        }
+        ReadStatus status = kStatusOk;
+        for (int64_t i = 0; i < count && status == kStatusOk; ++i) {
+            status = Visit(node, visitor);
+        }
+        return status;
+    }
+
+    ReadStatus VisitEntries(size_t node, int64_t count, ValueVisitor* visitor) {
+        ReadStatus status = kStatusOk;
+        for (int64_t i = 0; i < count && status == kStatusOk; ++i) {
+            if ((status = Visit(node, visitor)) == kStatusOk) {
+                status = Visit(skip_types_[node].end, visitor);
+            }
+        }
+        return status;
+    }
+
+    /* Decoded blocks go out as runs of int64_t, whatever the element type */
+    ReadStatus VisitPacked(size_t node, ValueVisitor* visitor) {
+        int64_t length = 0;
+        if (ReadStatus status = ReadContainerLength(&length); status != kStatusOk) {
+            return status;
+        }
+        visitor->BeginVector(length);
+        constexpr int kBlockSize = PackedVectorCodec::kBlockSize;
+        int64_t block[kBlockSize];
+        int64_t previous = 0;
+        for (; length >= kBlockSize; length -= kBlockSize) {
+            if (ReadStatus status = ReadPackedBlock(previous, block); status != kStatusOk) {
+                return status;
+            }
+            visitor->OnValues(TYPE_INT64, reinterpret_cast<const char*>(block), kBlockSize);
+            previous = block[kBlockSize - 1];
+        }
+        int tag = skip_types_[node + 1].tag;
+        for (; length > 0; --length) {
+            if (ReadStatus status = ReadPackedTail(&previous); status != kStatusOk) {
+                return status;
+            }
+            visitor->OnInt(previous, tag);
+        }
+        visitor->EndVector();
+        return kStatusOk;
+    }
+
+    ReadStatus VisitXor(size_t node, ValueVisitor* visitor) {
+        int tag = skip_types_[node + 1].tag;
+        if (tag != TYPE_FLOAT && tag != TYPE_DOUBLE) {
+            return kStatusMalformedData;
+        }
+        int64_t length = 0;
+        int64_t bytes = 0;
+        ReadStatus status = kStatusOk;
+        if ((status = ReadContainerLength(&length)) != kStatusOk ||
+                (status = ReadContainerLength(&bytes)) != kStatusOk) {
+            return status;
+        }
+        size_t size = tag == TYPE_FLOAT ? sizeof(float) : sizeof(double);
+        if (length > 0 && static_cast<uint64_t>(length - 1) > static_cast<uint64_t>(bytes) * 8) {
+            return kStatusMalformedData;
+        }
+        if (ExceedsLimit(length, size) || ExceedsLimit(bytes, 1)) {
+            return kStatusLimitExceeded;
+        }
+        if (!Fill(bytes)) {
+            return kStatusReadError;
+        }
+        visit_buffer_.resize(length * size);
+        bool decoded = tag == TYPE_FLOAT
+            ? XorFloatCodec<float>::Decode(cur_, bytes, length, reinterpret_cast<float*>(visit_buffer_.data()))
+            : XorFloatCodec<double>::Decode(cur_, bytes, length, reinterpret_cast<double*>(visit_buffer_.data()));
+        if (!decoded) {
+            return kStatusMalformedData;
+        }
+        cur_ += bytes;
+        visitor->BeginVector(length);
+        visitor->OnValues(tag, visit_buffer_.data(), length);
+        visitor->EndVector();
+        return kStatusOk;
+    }
+
+    ReadStatus VisitChunked(size_t node, ValueVisitor* visitor) {
+        bool map = skip_types_[node].tag == TYPE_CHUNKED_MAP;
+        if (map) {
+            visitor->BeginMap(-1);
+        } else {
+            visitor->BeginVector(-1);
+        }
+        int64_t length = 0;
+        ReadStatus status = kStatusOk;
+        while ((status = ReadContainerLength(&length)) == kStatusOk && length > 0) {
+            status = map ? VisitEntries(node + 1, length, visitor) : VisitElements(node + 1, length, visitor);
+            if (status != kStatusOk) {
+                return status;
+            }
+        }
+        if (status == kStatusOk && map) {
+            visitor->EndMap();
+        } else if (status == kStatusOk) {
+            visitor->EndVector();
+        }
+        return status;
+    }
+
+    /* A columnar vector's first child is its struct type, the columns come after it */
+    ReadStatus VisitColumns(size_t node, ValueVisitor* visitor) {
+        int64_t length = 0;
+        if (ReadStatus status = ReadContainerLength(&length); status != kStatusOk) {
+            return status;
+        }
+        bool map = skip_types_[node].tag == TYPE_COLUMNAR_MAP;
+        size_t column = map ? node + 1 : skip_types_[node + 1].end;
+        int64_t columns = map ? 2 : skip_types_[node].arity;
+        visitor->BeginColumns(map ? std::string_view() : SkipClassName(node + 1), length, columns);
+        ReadStatus status = kStatusOk;
+        for (int64_t i = 0; i < columns && status == kStatusOk; ++i) {
+            visitor->BeginVector(length);
+            if ((status = VisitElements(column, length, visitor)) == kStatusOk) {
+                visitor->EndVector();
+            }
+            column = skip_types_[column].end;
+        }
+        if (status == kStatusOk) {
+            visitor->EndColumns();
+        }
+        return status;
+    }
+
+    template <class Vector>
+    ReadStatus TryReadPacked(Vector* vec) {
+        using T = typename Vector::value_type;
+        int64_t length = 0;
+        if (ReadStatus status = ReadPackedHeader<T>(&length); status != kStatusOk) {
+            return status;
+        }
+        OOSF_STATS(CountGrowth(*vec, length);)
+
+        constexpr int kBlockSize = PackedVectorCodec::kBlockSize;
+        int64_t block[kBlockSize];
+        int64_t previous = 0;
+        int64_t done = 0;
+        for (; length - done >= kBlockSize; done += kBlockSize) {
+            if (vec->size() < static_cast<size_t>(done + kBlockSize)) {
+                vec->resize(GrowthStep(vec->size(), done + kBlockSize, length));
+            }
+            T* out = vec->data() + done;
+            int64_t* target = std::is_same_v<T, int64_t> ? reinterpret_cast<int64_t*>(out) : block;
+            if (ReadStatus status = ReadPackedBlock(previous, target); status != kStatusOk) {
+                return status;
+            }
+            if (target == block) {
+                std::copy(block, block + kBlockSize, out);
+            }
+            previous = target[kBlockSize - 1];
+        }
+        vec->resize(length);
+        for (T* out = vec->data() + done; done < length; ++done, ++out) {
+            if (ReadStatus status = ReadPackedTail(&previous); status != kStatusOk) {
+                return status;
+            }
+            *out = previous;
+        }
+        return kStatusOk;
+    }
+
+    /* Type header of the special encodings: a tag byte followed by the element types */
+    template <class... Inner>
+    ReadStatus CheckTaggedType() {
+        auto pos = Tell();
+        int64_t pin = Pin();
+        GetByte();
+        ReadStatus check = kStatusOk;
+        ((check = check == kStatusOk ? CheckType(static_cast<Inner*>(nullptr)) : check), ...);
+        Unpin(pin);
+        if (check != kStatusOk) {
+            Rewind(pos);
+        }
+        return check;
+    }
+
+    /* Chunked containers are a sequence of counted chunks ended by an empty one */
+    template <class Vector>
+    ReadStatus TryReadChunked(Vector* vec) {
+        using T = typename Vector::value_type;
+        if (ReadStatus check = CheckTaggedType<T>(); check != kStatusOk) {
+            return check;
+        }
+        vec->clear();
+        while (true) {
+            int64_t length = 0;
+            if (ReadStatus status = ReadContainerLength(&length); status != kStatusOk) {
+                return status;
+            }
+            if (length == 0) {
+                return kStatusOk;
+            }
+            if (ExceedsLimit(vec->size() + static_cast<uint64_t>(length), sizeof(T))) {
+                corrupted_ = true;
+                return kStatusLimitExceeded;
+            }
+            if (ReadStatus status = ReadElements(vec, vec->size(), length); status != kStatusOk) {
+                return status;
+            }
+        }
+    }
+
+    /* 'C', the struct type, the field count and types, then the length */
+    template <class T>
+    ReadStatus ReadColumnarHeader(int64_t* length) {
+        if (corrupted_) {
+            return kStatusReadError;
+        }
+        if (PeekByte() != TYPE_COLUMNAR_VECTOR) {
+            return PeekByte() < 0 ? (corrupted_ = true, kStatusReadError) : kStatusBadType;
+        }
+        auto pos = Tell();
+        int64_t pin = Pin();
+        int counter = StringCounter();
+        evicted_slots_.clear();
+        keep_evicted_ = true;
+        GetByte();
+        ReadStatus check = CheckType(static_cast<T*>(nullptr));
+        int64_t count = 0;
+        if (check == kStatusOk && (check = TryReadMinimal(&count)) == kStatusOk &&
+                count != static_cast<int64_t>(kFieldCount<T>)) {
+            check = kStatusBadType;
+        }
+        ForEachField<T>([&](auto member) {
+            if (check == kStatusOk) {
+                check = CheckType(static_cast<typename MemberType<decltype(member)>::type*>(nullptr));
+            }
+        });
+        keep_evicted_ = false;
+        Unpin(pin);
+        if (check != kStatusOk) {
+            /* OOSFv1 class names read so far are numbered again when the header is read again */
+            RestoreStringCache(counter);
+            Rewind(pos);
+            return check;
+        }
+        if (ReadStatus status = ReadContainerLength(length); status != kStatusOk) {
+            return status;
+        }
+        if (ExceedsLimit(*length, sizeof(T))) {
+            corrupted_ = true;
+            return kStatusLimitExceeded;
+        }
+        return kStatusOk;
+    }
+
+    /* Like the element by element path, this reads into existing elements: unlisted fields keep their values */
+    template <class Vector>
+    ReadStatus TryReadColumnarStructs(Vector* vec) {
+        using T = typename Vector::value_type;
+        int64_t length = 0;
+        if (ReadStatus status = ReadColumnarHeader<T>(&length); status != kStatusOk) {
+            return status;
+        }
+        OOSF_STATS(CountGrowth(*vec, length);)
+        vec->resize(std::min<uint64_t>(vec->size(), length));
+        ReadStatus status = kStatusOk;
+        ForEachField<T>([&](auto member) {
+            for (int64_t i = 0; i < length && status == kStatusOk; ++i) {
+                /* Only the first column grows the vector */
+                if (static_cast<size_t>(i) == vec->size()) {
+                    vec->resize(GrowthStep(i, i + 1, length));
+                }
+                status = ReadObject(&((*vec)[i].*member));
+            }
+        });
+        if (status != kStatusOk) {
+            corrupted_ = true;
+        }
+        return status;
+    }
+
+    template <class K, class V, class Map>
+    ReadStatus TryReadMap(Map* map) {
+        if (!corrupted_ && PeekByte() == TYPE_CHUNKED_MAP) {
+            return TryReadChunkedMap<K, V>(map);
+        }
+        if (!corrupted_ && PeekByte() == TYPE_COLUMNAR_MAP) {
+            return TryReadColumnarMap<K, V>(map);
+        }
+        return TryReadValue(map);
+    }
+
+    template <class K, class V, class Map>
+    ReadStatus TryReadChunkedMap(Map* map) {
+        if (ReadStatus check = CheckTaggedType<K, V>(); check != kStatusOk) {
+            return check;
+        }
+        MapFiller<Map> filler(map);
+        uint64_t total = 0;
+        while (true) {
+            int64_t length = 0;
+            if (ReadStatus status = ReadContainerLength(&length); status != kStatusOk) {
+                return status;
+            }
+            if (length == 0) {
+                return kStatusOk;
+            }
+            total += length;
+            if (ExceedsLimit(total, sizeof(typename Map::value_type))) {
+                corrupted_ = true;
+                return kStatusLimitExceeded;
+            }
+            filler.Reserve(ReserveHint(length));
+            if (ReadStatus status = ReadMapEntries<K, V>(map, &filler, length); status != kStatusOk) {
+                return status;
+            }
+        }
+    }
+
+    /* Columns are read whole, so raw arithmetic keys and values are copied in bulk */
+    template <class K, class V, class Map>
+    ReadStatus TryReadColumnarMap(Map* map) {
+        if (ReadStatus check = CheckTaggedType<K, V>(); check != kStatusOk) {
+            return check;
+        }
+        int64_t length = 0;
+        if (ReadStatus status = ReadContainerLength(&length); status != kStatusOk) {
+            return status;
+        }
+        if (ExceedsLimit(length, sizeof(typename Map::value_type))) {
+            corrupted_ = true;
+            return kStatusLimitExceeded;
+        }
+        Column<K> keys;
+        Column<V> values;
+        ReadStatus status = kStatusOk;
+        if ((status = ReadElements(&keys, 0, length)) != kStatusOk ||
+                (status = ReadElements(&values, 0, length)) != kStatusOk) {
+            return status;
+        }
+        MapFiller<Map> filler(map);
+        filler.Reserve(length);
+        OOSF_STATS(stats_.stats.allocations += MapFiller<Map>::kAllocatesNodes ? length : 0;)
+        for (int64_t i = 0; i < length; ++i) {
+            filler.Add(std::move(keys[i]), std::move(values[i]));
+        }
+        return kStatusOk;
+    }
+
+    /* std::vector<bool> has no data(), and bools are stored as single bytes anyway */
+    template <class T>
+    using Column = std::vector<std::conditional_t<std::is_same_v<T, bool>, int8_t, T>>;
+
+    template <class Map, class = void>
+    class IsReservable : public std::false_type {};
+
+    template <class Map>
+    class IsReservable<Map, std::void_t<decltype(std::declval<Map&>().reserve(0))>> : public std::true_type {};
+
+    /*
+     * Collects decoded entries: std::map gets end-hinted moves, so sorted input loads in linear time, hash maps
+     * are reserved up front and FlatMap is filled with a single replace() once the filler goes away.
+     */
+    template <class Map>
+    class MapFiller {
+    public:
+        static constexpr bool kAllocatesNodes = true;
+
+        explicit MapFiller(Map* map) : map_(map) {
+        }
+
+        void Reserve(size_t count) {
+            if constexpr (IsReservable<Map>::value) {
+                map_->reserve(map_->size() + count);
+            }
+        }
+
+        template <class Key, class Value>
+        void Add(Key&& key, Value&& value) {
+            map_->emplace_hint(map_->end(), std::forward<Key>(key), std::forward<Value>(value));
+        }
+
+    private:
+        Map* map_;
+    };
+
+    template <class K, class V, class... Args>
+    class MapFiller<FlatMap<K, V, Args...>> {
+    public:
+        static constexpr bool kAllocatesNodes = false;
+
+        explicit MapFiller(FlatMap<K, V, Args...>* map) : map_(map), entries_(std::move(*map).extract()) {
+        }
+
+        ~MapFiller() {
+            map_->replace(std::move(entries_));
+        }
+
+        void Reserve(size_t count) {
+            entries_.reserve(entries_.size() + count);
+        }
+
+        template <class Key, class Value>
+        void Add(Key&& key, Value&& value) {
+            entries_.emplace_back(std::forward<Key>(key), std::forward<Value>(value));
+        }
+
+    private:
+        FlatMap<K, V, Args...>* map_;
+        typename FlatMap<K, V, Args...>::container_type entries_;
+    };
+
+    /* Announced lengths are only trusted as far as the rest of the input could hold them */
+    size_t ReserveHint(int64_t length) const {
+        uint64_t available = source_->Data() ? end_ - cur_ : kBufferSize;
+        return std::min<uint64_t>(length, available);
+    }
+
+    /*
+     * Size to grow a vector of `size` elements to when `needed` of the `length` announced ones are: at least
+     * double, but beyond ReserveHint() only as the elements arrive, so a corrupt length runs out of input first.
+     */
+    int64_t GrowthStep(int64_t size, int64_t needed, int64_t length) const {
+        int64_t hint = ReserveHint(length);
+        return std::min(length, std::max({needed, 2 * size, hint}));
+    }
+
+    template <class T>
+    ReadStatus ReadPackedHeader(int64_t* length) {
+        if (ReadStatus check = CheckTaggedType<T>(); check != kStatusOk) {
+            return check;
+        }
+
+        if (ReadStatus status = ReadLength(length); status != kStatusOk) {
+            corrupted_ = true;
+            return status == kStatusReadError ? kStatusReadError : kStatusMalformedData;
+        }
+        if (source_->Data() && *length / PackedVectorCodec::kBlockSize > (end_ - cur_) / 9) {
+            corrupted_ = true;
+            return kStatusMalformedData;
+        }
+        if (ExceedsLimit(*length, sizeof(T))) {
+            corrupted_ = true;
+            return kStatusLimitExceeded;
+        }
+        return kStatusOk;
+    }
+
+    ReadStatus ReadPackedBlock(int64_t previous, int64_t* out) {
+        if (!Fill(1) || !Fill(PackedVectorCodec::BlockBytes(*cur_))) {
+            corrupted_ = true;
+            return kStatusReadError;
+        }
+        if ((*cur_ & 0x7f) > 64) {
+            corrupted_ = true;
+            return kStatusMalformedData;
+        }
+        PackedVectorCodec::DecodeBlock(cur_, previous, out);
+        cur_ += PackedVectorCodec::BlockBytes(*cur_);
+        return kStatusOk;
+    }
+
+    /* Values after the last full block are zig-zag varint deltas */
+    ReadStatus ReadPackedTail(int64_t* previous) {
+        uint64_t delta = 0;
+        if (!ReadVarint(&delta)) {
+            corrupted_ = true;
+            return kStatusReadError;
+        }
+        *previous = static_cast<uint64_t>(*previous) + static_cast<uint64_t>(UnZigZag(delta));
+        return kStatusOk;
+    }
+
+    template <class Vector>
+    ReadStatus TryReadCompressed(Vector* vec) {
+        using T = typename Vector::value_type;
+        if (ReadStatus check = CheckTaggedType<T>(); check != kStatusOk) {
+            return check;
+        }
+
+        int64_t length = 0;
+        int64_t bytes = 0;
+        ReadStatus status = kStatusOk;
+        if ((status = ReadLength(&length)) != kStatusOk || (status = ReadLength(&bytes)) != kStatusOk) {
+            corrupted_ = true;
+            return status == kStatusReadError ? kStatusReadError : kStatusMalformedData;
+        }
+        /* Every value after the first one takes at least one bit */
+        if (length > 0 && static_cast<uint64_t>(length - 1) > static_cast<uint64_t>(bytes) * 8) {
+            corrupted_ = true;
+            return kStatusMalformedData;
+        }
+        if (ExceedsLimit(length, sizeof(T)) || ExceedsLimit(bytes, 1)) {
+            corrupted_ = true;
+            return kStatusLimitExceeded;
+        }
+        if (!Fill(bytes)) {
+            corrupted_ = true;
+            return kStatusReadError;
+        }
+        OOSF_STATS(CountGrowth(*vec, length);)
+        vec->resize(length);
+        if (!XorFloatCodec<T>::Decode(cur_, bytes, length, vec->data())) {
+            corrupted_ = true;
+            return kStatusMalformedData;
+        }
+        cur_ += bytes;
+        return kStatusOk;
+    }
+
+    inline int PeekByte() {
+        if (cur_ == end_ && !Fill(1)) {
+            return -1;
+        }
+        return static_cast<unsigned char>(*cur_);
+    }
+
+    ReadStatus ReadHeader() {
+        if (const char* data = source_->Data()) {
+            begin_ = cur_ = data;
+            end_ = data + source_->Size();
+            eof_ = true;
+        }
+        header_status_ = ReadHeaderFields();
+        corrupted_ = header_status_ != kStatusOk;
+        return header_status_;
+    }
+
+    ReadStatus ReadHeaderFields() {
+        std::string signature;
+        if (ReadStatus status = TryRead(&signature); status != kStatusOk) {
+            return status;
+        }
+        if (signature == "OOSFv1") {
+            version_ = kFormatV1;
+        } else if (signature == "OOSFv2") {
+            version_ = kFormatV2;
+            int flags = GetByte();
+            if (flags < 0) {
+                return kStatusReadError;
+            }
+            if ((flags & ~kKnownFlags) != 0) {
+                return kStatusUnsupported;
+            }
+            flags_ = flags;
+        } else {
+            return kStatusBadType;
+        }
+        int64_t cache_size = 0;
+        if (ReadStatus status = ReadLength(&cache_size); status != kStatusOk) {
+            return status;
+        }
+        if (cache_size > INT32_MAX) {
+            return kStatusMalformedData;
+        }
+        string_cache_size_ = cache_size;
+        if (flags_ & (kFlagSharedDictionary | kFlagEmbeddedDictionary)) {
+            return ReadDictionary();
+        }
+        return kStatusOk;
+    }
+
+    /* A shared dictionary has to be the one the stream was written with; an embedded one is decoded here */
+    ReadStatus ReadDictionary() {
+        if ((flags_ & kFlagSharedDictionary) && (flags_ & kFlagEmbeddedDictionary)) {
+            return kStatusMalformedData;
+        }
+        int64_t size = 0;
+        if (ReadStatus status = ReadLength(&size); status != kStatusOk) {
+            return status;
+        }
+        if (size > INT32_MAX) {
+            return kStatusMalformedData;
+        }
+        if (flags_ & kFlagSharedDictionary) {
+            uint64_t fingerprint = 0;
+            if (!ReadBytes(&fingerprint, sizeof(fingerprint))) {
+                return kStatusReadError;
+            }
+            if (!shared_dictionary_ || shared_dictionary_->Size() != static_cast<uint64_t>(size) ||
+                    shared_dictionary_->Fingerprint() != fingerprint) {
+                return kStatusBadType;
+            }
+            dictionary_ = shared_dictionary_;
+        } else {
+            if (ExceedsLimit(size, sizeof(std::string))) {
+                return kStatusLimitExceeded;
+            }
+            std::vector<std::string> entries;
+            entries.reserve(ReserveHint(size));
+            for (int64_t i = 0; i < size; ++i) {
+                CachedString entry;
+                if (ReadStatus status = ReadString(&entry); status != kStatusOk) {
+                    return status;
+                }
+                entries.emplace_back(entry.view);
+            }
+            embedded_dictionary_ = std::make_unique<StringDictionary>(std::move(entries));
+            dictionary_ = embedded_dictionary_.get();
+        }
+        dictionary_size_ = size;
+        return kStatusOk;
+    }
+
+    /* Reads the index and returns to where the stream was, so looking at the index never disturbs reading */
+    ReadStatus LoadIndex() {
+        uint64_t size = source_->Size();
+        int64_t pos = Tell();
+        bool corrupted = corrupted_;
+        if (pinned_ >= 0 || size < INDEX_TRAILER_SIZE || !Jump(size - INDEX_TRAILER_SIZE)) {
+            return kStatusUnsupported;
+        }
+        corrupted_ = false;
+        ReadStatus status = ReadIndex(size);
+        corrupted_ = corrupted || !Jump(pos);
+        return status;
+    }
+
+    /* The trailer points back to the index, which lists the distance from the index back to every record */
+    ReadStatus ReadIndex(uint64_t size) {
+        char trailer[INDEX_TRAILER_SIZE];
+        uint64_t distance = 0;
+        if (!ReadBytes(trailer, INDEX_TRAILER_SIZE)) {
+            return kStatusReadError;
+        }
+        std::memcpy(&distance, trailer, sizeof(distance));
+        if (std::memcmp(trailer + sizeof(distance), INDEX_MAGIC, INDEX_TRAILER_SIZE - sizeof(distance)) != 0 ||
+                distance > size - INDEX_TRAILER_SIZE) {
+            return kStatusMalformedData;
+        }
+        uint64_t index = size - INDEX_TRAILER_SIZE - distance;
+        if (!Jump(index) || GetByte() != TYPE_INDEX) {
+            return kStatusMalformedData;
+        }
+        int64_t count = 0;
+        if (ReadStatus status = ReadLength(&count); status != kStatusOk) {
+            return status;
+        }
+        if (static_cast<uint64_t>(count) > distance || ExceedsLimit(count, sizeof(uint64_t))) {
+            return kStatusMalformedData;
+        }
+        record_offsets_.resize(count);
+        for (uint64_t& offset : record_offsets_) {
+            int64_t back = 0;
+            if (ReadStatus status = ReadLength(&back); status != kStatusOk) {
+                return status;
+            }
+            if (static_cast<uint64_t>(back) > index) {
+                return kStatusMalformedData;
+            }
+            offset = index - back;
+        }
+        index_loaded_ = true;
+        return kStatusOk;
+    }
+
+    /* Restarts reading at an absolute offset of the source */
+    bool Jump(uint64_t offset) {
+        OOSF_STATS(++stats_.stats.seeks;)
+        if (const char* data = source_->Data()) {
+            if (offset > source_->Size()) {
+                return false;
+            }
+            begin_ = data;
+            cur_ = data + offset;
+            window_offset_ = 0;
+            return true;
+        }
+        if (!source_->Seek(offset)) {
+            return false;
+        }
+        begin_ = cur_ = end_ = buffer_.data();
+        window_offset_ = offset;
+        eof_ = false;
+        return true;
+    }
+
+    ReadStatus ReadLength(int64_t* length) {
+        if (version_ == kFormatV1) {
+            return TryReadMinimal(length);
+        }
+        uint64_t value = 0;
+        if (!ReadVarint(&value)) {
+            return kStatusReadError;
+        }
+        if (value > static_cast<uint64_t>(INT64_MAX)) {
+            return kStatusMalformedData;
+        }
+        *length = value;
+        return kStatusOk;
+    }
+
+    /* Length of a vector or map body whose type header has already been checked */
+    ReadStatus ReadContainerLength(int64_t* length) {
+        ReadStatus status = ReadLength(length);
+        if (status != kStatusOk || *length < 0) {
+            corrupted_ = true;
+            return status == kStatusReadError ? kStatusReadError : kStatusMalformedData;
+        }
+        return kStatusOk;
+    }
+
+    inline bool ExceedsLimit(uint64_t count, size_t element_size) const {
+        return count > max_allocation_ / element_size;
+    }
+
+    ReadStatus ReadSignedLength(int64_t* length) {
+        if (version_ == kFormatV1) {
+            return TryReadMinimal(length);
+        }
+        uint64_t value = 0;
+        if (!ReadVarint(&value)) {
+            return kStatusReadError;
+        }
+        *length = UnZigZag(value);
+        return kStatusOk;
+    }
+
+    static inline int64_t UnZigZag(uint64_t value) {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    inline bool ReadVarint(uint64_t* value) {
+        if (end_ - cur_ >= 10) {
+            const unsigned char* ptr = reinterpret_cast<const unsigned char*>(cur_);
+            uint64_t result = 0;
+            for (int shift = 0; shift < 70; shift += 7) {
+                uint64_t byte = *ptr++;
+                result |= (byte & 0x7f) << shift;
+                if (byte < 0x80) {
+                    cur_ = reinterpret_cast<const char*>(ptr);
+                    *value = result;
+                    return true;
+                }
+            }
+            return false;
+        }
+        return ReadVarintSlow(value);
+    }
+
+    bool ReadVarintSlow(uint64_t* value) {
+        uint64_t result = 0;
+        for (int shift = 0; shift < 70; shift += 7) {
+            int byte = GetByte();
+            if (byte < 0) {
+                return false;
+            }
+            result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (byte < 0x80) {
+                *value = result;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <class T>
+    inline bool IsVarint() const {
+        return std::is_integral_v<T> && sizeof(T) > 1 && (flags_ & kFlagVarintIntegers);
+    }
+
+    template <class T>
+    ReadStatus ReadInteger(T* value) {
+        if (IsVarint<T>()) {
+            uint64_t raw = 0;
+            if (!ReadVarint(&raw)) {
+                corrupted_ = true;
+                return kStatusReadError;
+            }
+            int64_t result = UnZigZag(raw);
+            if (result < std::numeric_limits<T>::min() || result > std::numeric_limits<T>::max()) {
+                corrupted_ = true;
+                return kStatusMalformedData;
+            }
+            *value = result;
+            return kStatusOk;
+        }
+        return !ReadBytes(value, sizeof(T)) ? (corrupted_ = true, kStatusReadError) : kStatusOk;
+    }
+
+    ReadStatus ReadBool(bool* var) {
+        auto pos = Tell();
+        int sym1 = GetByte();
+        if (sym1 < 0) {
+            Rewind(pos);
+            return kStatusReadError;
+        }
+        if (sym1 == '+' || sym1 == '-') {
+            *var = sym1 == '+';
+            return kStatusOk;
+        }
+        if (sym1 == '?') {
+            int sym2 = GetByte();
+            if (sym2 < 0) {
+                Rewind(pos);
+                return kStatusReadError;
+            }
+            *var = sym2;
+            return kStatusOk;
+        }
+
+        Rewind(pos);
+        return kStatusBadType;
+    }
+
+#define CHECK_FIRST_LETTER(symbol) {                                    \
+    int ch = GetByte();                                                 \
+    /*LOG(ch);*/                                                        \
+    if (ch != symbol) {                                                 \
+        if (ch < 0) {                                                   \
+            corrupted_ = true;                                          \
+            return kStatusReadError;                                    \
+        }                                                               \
+        Rewind(pos);                                                    \
+        return kStatusBadType;                                          \
+    }                                                                   \
+}
+    template <class T>
+    ReadStatus CheckType(T*) {
+        if constexpr (std::is_base_of_v<Serializable, std::decay_t<T>> || IsReflected<std::decay_t<T>>::value) {
+            auto pos = Tell();
+            CHECK_FIRST_LETTER(TYPE_STRUCT);
+            if (version_ != kFormatV1) {
+                return CheckClassId(pos, typeid(std::decay_t<T>));
+            }
+
+            CachedString str;
+            ReadStatus string_check = ReadString(&str);
+            if (string_check != kStatusOk) {
+                Rewind(pos);
+                return string_check;
+            }
+
+            auto type_index = std::type_index(typeid(std::decay_t<T>));
+            auto iter = registered_classes_.find(type_index);
+            if (iter == registered_classes_.end() || iter->second != str.view) {
+                Rewind(pos);
+                return kStatusBadType;
+            }
+
+            UpdateStringCache(str);
+            return kStatusOk;
+
+        } else {
+            return kStatusBadType;
+        }
+    }
+
+
+    ReadStatus CheckClassId(int64_t pos, const std::type_info& type) {
+        uint64_t code = 0;
+        if (!ReadVarint(&code)) {
+            corrupted_ = true;
+            return kStatusReadError;
+        }
+        uint64_t id = code >> 1;
+        if (code & 1) {
+            if (ReadStatus status = ReadClassDeclaration(id); status != kStatusOk) {
+                corrupted_ = true;
+                return status;
+            }
+        } else if (id >= class_table_.size()) {
+            corrupted_ = true;
+            return kStatusMalformedData;
+        }
+
+        ClassEntry& entry = class_table_[id];
+        if (!entry.type) {
+            auto iter = registered_names_.find(entry.name);
+            entry.type = iter == registered_names_.end() ? nullptr : iter->second;
+        }
+        if (!entry.type || *entry.type != type) {
+            Rewind(pos);
+            return kStatusBadType;
+        }
+        return kStatusOk;
+    }
+
+    /* A declaration seen again after a rewind must repeat the name it was declared with */
+    ReadStatus ReadClassDeclaration(uint64_t id) {
+        int64_t length = 0;
+        if (ReadStatus status = ReadLength(&length); status != kStatusOk) {
+            return status;
+        }
+        if (id > class_table_.size() || length < 0) {
+            return kStatusMalformedData;
+        }
+        if (ExceedsLimit(length, 1)) {
+            return kStatusLimitExceeded;
+        }
+        if (!Fill(length)) {
+            return kStatusReadError;
+        }
+        std::string_view name(cur_, length);
+        cur_ += length;
+        if (id < class_table_.size()) {
+            return class_table_[id].name == name ? kStatusOk : kStatusMalformedData;
+        }
+        class_table_.push_back({std::string(name), nullptr});
+        return kStatusOk;
+    }
+
+#define CHECK_SIMPLE_TYPE(type, symbol)                                 \
+        ReadStatus CheckType(type*) {                                   \
+            auto pos = Tell();                                          \
+            CHECK_FIRST_LETTER(symbol)                                  \
+            return kStatusOk;                                           \
+        }
+
+#define READ_SIMPLE_TYPE(type)                                          \
+        ReadStatus ReadObject(type* value) {                            \
+            return !ReadBytes(value, sizeof(type)) ?                    \
+                    (corrupted_ = true, kStatusReadError) : kStatusOk;  \
+        }
+
+#define READ_INTEGER(type)                                              \
+        ReadStatus ReadObject(type* value) {                            \
+            return ReadInteger(value);                                  \
+        }
+
+#define READ_CHECK(type, symbol) CHECK_SIMPLE_TYPE(type, symbol) READ_SIMPLE_TYPE(type)
+#define READ_CHECK_INTEGER(type, symbol) CHECK_SIMPLE_TYPE(type, symbol) READ_INTEGER(type)
+
+    READ_CHECK_INTEGER(int8_t   , TYPE_INT8     )
+    READ_CHECK_INTEGER(int16_t  , TYPE_INT16    )
+    READ_CHECK_INTEGER(int32_t  , TYPE_INT32    )
+    READ_CHECK_INTEGER(int64_t  , TYPE_INT64    )
+    READ_CHECK(double   , TYPE_DOUBLE   )
+    READ_CHECK(float    , TYPE_FLOAT    )
+    /* Inside containers bools are one-byte integers, as TypeSignature writes them; see TryRead(bool*) otherwise */
+    READ_CHECK(bool     , TYPE_INT8     )
+
+    CHECK_SIMPLE_TYPE(String, TYPE_STRING)
+
+    template <class Alloc>
+    ReadStatus CheckType(std::basic_string<char, std::char_traits<char>, Alloc>*) {
+        return CheckType(static_cast<String*>(nullptr));
+    }
+
+    /* Views point into the source memory, so they need a contiguous source */
+    ReadStatus CheckType(std::string_view*) {
+        if (!source_->Data()) {
+            return kStatusUnsupported;
+        }
+        return CheckType(static_cast<String*>(nullptr));
+    }
+
+    template <class T>
+    ReadStatus CheckType(VectorView<T>*) {
+        if (!source_->Data() || IsVarint<T>()) {
+            return kStatusUnsupported;
+        }
+        return CheckType(static_cast<std::vector<T>*>(nullptr));
+    }
+
+#undef READ_CHECK
+#undef READ_CHECK_INTEGER
+#undef READ_INTEGER
+#undef CHECK_SIMPLE_TYPE
+#undef READ_SIMPLE_TYPE
+
+#define CHECK_SUBTYPE(type) {                           \
+    ReadStatus inner_check = CheckType((type*)nullptr); \
+    if (inner_check != kStatusOk) {                     \
+        Rewind(pos);               \
+        return inner_check;                             \
+    }                                                   \
+}
+    /* Compares the whole compile-time type header against the buffer at once */
+    template <class T>
+    ReadStatus CheckSignature() {
+        using Signature = typename TypeSignature<T>::type;
+        if (Fill(Signature::size)) {
+            if (std::memcmp(cur_, Signature::value, Signature::size) != 0) {
+                return kStatusBadType;
+            }
+            cur_ += Signature::size;
+            return kStatusOk;
+        }
+        if (std::memcmp(cur_, Signature::value, end_ - cur_) != 0) {
+            return kStatusBadType;
+        }
+        corrupted_ = true;
+        return kStatusReadError;
+    }
+
+    template <class T, class... Args>
+    ReadStatus CheckType(std::vector<T, Args...>*) {
+        if constexpr (TypeSignature<std::vector<T, Args...>>::kSupported) {
+            return CheckSignature<std::vector<T, Args...>>();
+        }
+        auto pos = Tell();
+        CHECK_FIRST_LETTER(TYPE_VECTOR)
+        CHECK_SUBTYPE(T)
+        return kStatusOk;
+    }
+
+    template <class K, class V, class... Args>
+    ReadStatus CheckType(std::map<K, V, Args...>*) {
+        if constexpr (TypeSignature<std::map<K, V, Args...>>::kSupported) {
+            return CheckSignature<std::map<K, V, Args...>>();
+        }
+        auto pos = Tell();
+        CHECK_FIRST_LETTER(TYPE_MAP)
+        CHECK_SUBTYPE(K)
+        CHECK_SUBTYPE(V)
+        return kStatusOk;
+    }
+
+    template <class K, class V, class... Args>
+    ReadStatus CheckType(std::unordered_map<K, V, Args...>*) {
+        return CheckType(static_cast<std::map<K, V>*>(nullptr));
+    }
+
+    template <class K, class V, class... Args>
+    ReadStatus CheckType(FlatMap<K, V, Args...>*) {
+        return CheckType(static_cast<std::map<K, V>*>(nullptr));
+    }
+
+#define READ_LENGTH                                                                 \
+int64_t length = 0;                                                                 \
+ReadStatus status = kStatusOk;                                                      \
+if ((status = ReadLength(&length)) != kStatusOk) {                                  \
+    corrupted_ = true;                                                              \
+    return status == kStatusReadError ? kStatusReadError : kStatusMalformedData;    \
+}
+
+    /* Arrays are vectors whose length has to match, see ReadObject */
+    template <class T, size_t N>
+    ReadStatus CheckType(std::array<T, N>*) {
+        return CheckType(static_cast<std::vector<T>*>(nullptr));
+    }
+
+    /* A tuple of another arity is another type, so the stream is rewound */
+    template <class... Args>
+    ReadStatus CheckType(std::tuple<Args...>*) {
+        if constexpr (TypeSignature<std::tuple<Args...>>::kSupported) {
+            return CheckSignature<std::tuple<Args...>>();
+        }
+        auto pos = Tell();
+        CHECK_FIRST_LETTER(TYPE_TUPLE)
+        int64_t arity = 0;
+        ReadStatus check = TryReadMinimal(&arity);
+        if (check == kStatusOk && arity != static_cast<int64_t>(sizeof...(Args))) {
+            check = kStatusBadType;
+        }
+        ((check = check == kStatusOk ? CheckType(static_cast<Args*>(nullptr)) : check), ...);
+        if (check != kStatusOk) {
+            Rewind(pos);
+        }
+        return check;
+    }
+
+    template <class First, class Second>
+    ReadStatus CheckType(std::pair<First, Second>*) {
+        return CheckType(static_cast<std::tuple<First, Second>*>(nullptr));
+    }
+
+#undef CHECK_SUBTYPE
+#undef CHECK_FIRST_LETTER
+
+    template <class T, class=std::enable_if_t<std::is_base_of_v<Serializable, std::decay_t<T>>>>
+    ReadStatus ReadObject(T* obj) {
+        return ReadFramed([this, obj] { return obj->TryRead(this); });
+    }
+
+    /* Field by field, as a Serializable reading the same fields would */
+    template <class T>
+    std::enable_if_t<IsReflected<T>::value, ReadStatus> ReadObject(T* obj) {
+        return ReadFramed([this, obj] {
+            ReadStatus status = kStatusOk;
+            ForEachField<T>([&](auto member) {
+                if (status == kStatusOk) {
+                    status = TryRead(&(obj->*member));
+                }
+            });
+            return status;
+        });
+    }
+
+    template <class Alloc>
+    ReadStatus ReadObject(std::basic_string<char, std::char_traits<char>, Alloc>* str) {
+        CachedString buf;
+        ReadStatus status = ReadString(&buf);
+        if (status == kStatusOk) {
+            OOSF_STATS(CountGrowth(*str, buf.view.size());)
+            str->assign(buf.view);
+            UpdateStringCache(buf);
+        }
+        return status;
+    }
+
+    ReadStatus ReadObject(std::string_view* str) {
+        CachedString buf;
+        ReadStatus status = ReadString(&buf);
+        if (status == kStatusOk) {
+            *str = buf.view;
+            UpdateStringCache(buf);
+        }
+        return status;
+    }
+
+    template <class T>
+    ReadStatus ReadObject(VectorView<T>* view) {
+        READ_LENGTH
+        if (length < 0 || static_cast<uint64_t>(length) > static_cast<uint64_t>(end_ - cur_) / sizeof(T)) {
+            corrupted_ = true;
+            return kStatusMalformedData;
+        }
+        *view = VectorView<T>(cur_, length);
+        cur_ += length * sizeof(T);
+        return kStatusOk;
+    }
+
+    template <class T, size_t N>
+    ReadStatus ReadObject(std::array<T, N>* array) {
+        READ_LENGTH
+        if (length != static_cast<int64_t>(N)) {
+            corrupted_ = true;
+            return kStatusMalformedData;
+        }
+        if constexpr (std::is_arithmetic_v<T>) {
+            if (!IsVarint<T>()) {
+                return N == 0 || ReadBytes(array->data(), N * sizeof(T)) ? kStatusOk
+                                                                          : (corrupted_ = true, kStatusReadError);
+            }
+        }
+        for (T& element : *array) {
+            if ((status = ReadObject(&element)) != kStatusOk) {
+                corrupted_ = true;
+                return status;
+            }
+        }
+        return kStatusOk;
+    }
+
+    template <class... Args>
+    ReadStatus ReadObject(std::tuple<Args...>* tuple) {
+        ReadStatus status = kStatusOk;
+        std::apply([&](auto&... elements) {
+            ((status = status == kStatusOk ? ReadObject(&elements) : status), ...);
+        }, *tuple);
+        if (status != kStatusOk) {
+            corrupted_ = true;
+        }
+        return status;
+    }
+
+    template <class First, class Second>
+    ReadStatus ReadObject(std::pair<First, Second>* pair) {
+        ReadStatus status = kStatusOk;
+        if ((status = ReadObject(&pair->first)) != kStatusOk || (status = ReadObject(&pair->second)) != kStatusOk) {
+            corrupted_ = true;
+        }
+        return status;
+    }
+
+    template <class T, class... Args>
+    ReadStatus ReadObject(std::vector<T, Args...>* vec) {
+        READ_LENGTH
+        if (length < 0) {
+            corrupted_ = true;
+            return kStatusMalformedData;
+        }
+        if (ExceedsLimit(length, sizeof(T))) {
+            corrupted_ = true;
+            return kStatusLimitExceeded;
+        }
+        return ReadElements(vec, 0, length);
+    }
+
+    /* Resizes the vector to offset + length and reads the elements from `offset` on */
+    template <class Vector>
+    ReadStatus ReadElements(Vector* vec, size_t offset, int64_t length) {
+        using T = typename Vector::value_type;
+        if constexpr (std::is_arithmetic_v<T>) {
+            if (!IsVarint<T>()) {
+                return ReadBlock(vec, offset, length);
+            }
+        }
+        OOSF_STATS(CountGrowth(*vec, offset + length);)
+        vec->resize(std::min<uint64_t>(vec->size(), offset + length));
+
+        for (int64_t i = 0; i < length; ++i) {
+            if (offset + i == vec->size()) {
+                vec->resize(offset + GrowthStep(i, i + 1, length));
+            }
+            if (ReadStatus status = ReadObject(&(*vec)[offset + i]); status != kStatusOk) {
+                corrupted_ = true;
+                return status;
+            }
+        }
+        return kStatusOk;
+    }
+
+    template <class Vector>
+    ReadStatus ReadBlock(Vector* vec, size_t offset, int64_t length) {
+        using T = typename Vector::value_type;
+        if (static_cast<uint64_t>(length) > (SIZE_MAX - offset * sizeof(T)) / sizeof(T) ||
+                (source_->Data() && static_cast<uint64_t>(length) * sizeof(T) > static_cast<uint64_t>(end_ - cur_))) {
+            corrupted_ = true;
+            return kStatusMalformedData;
+        }
+        OOSF_STATS(CountGrowth(*vec, offset + length);)
+        /* The rest of a memory source was checked to hold the elements; other sources are read as they arrive */
+        int64_t done = 0;
+        do {
+            int64_t size = source_->Data() ? length : GrowthStep(done, done + 1, length);
+            vec->resize(offset + size);
+            if (size > done && !ReadBytes(vec->data() + offset + done, (size - done) * sizeof(T))) {
+                corrupted_ = true;
+                return kStatusReadError;
+            }
+            done = size;
+        } while (done < length);
+        return kStatusOk;
+    }
+
+    template <class K, class V, class... Args>
+    ReadStatus ReadObject(std::map<K, V, Args...>* map) {
+        return ReadAsMap<K, V>(map);
+    }
+
+    template <class K, class V, class... Args>
+    ReadStatus ReadObject(std::unordered_map<K, V, Args...>* map) {
+        return ReadAsMap<K, V>(map);
+    }
+
+    template <class K, class V, class... Args>
+    ReadStatus ReadObject(FlatMap<K, V, Args...>* map) {
+        return ReadAsMap<K, V>(map);
+    }
+
+    template <class K, class V, class Map>
+    ReadStatus ReadAsMap(Map* map) {
+        READ_LENGTH
         if (length < 0) {
             corrupted_ = true;
             return kStatusMalformedData;
         }
+        if (ExceedsLimit(length, sizeof(typename Map::value_type))) {
+            corrupted_ = true;
+            return kStatusLimitExceeded;
+        }
+        MapFiller<Map> filler(map);
+        filler.Reserve(ReserveHint(length));
+        return ReadMapEntries<K, V>(map, &filler, length);
+    }
 
-        for (int i = 0; i < length; ++i) {
-            K key;
-            V value;
+    template <class K, class V, class Map>
+    ReadStatus ReadMapEntries(Map* map, MapFiller<Map>* filler, int64_t length) {
+        for (int64_t i = 0; i < length; ++i) {
+            K key = MakeElement<K>(map->get_allocator());
+            V value = MakeElement<V>(map->get_allocator());
             ReadStatus status = kStatusOk;
             if ((status = ReadObject(&key)) != kStatusOk || (status = ReadObject(&value)) != kStatusOk) {
                 corrupted_ = true;
                 return status;
             }
-            map->emplace(std::make_pair(key, value));
+            OOSF_STATS(stats_.stats.allocations += MapFiller<Map>::kAllocatesNodes;)
+            filler->Add(std::move(key), std::move(value));
         }
         return kStatusOk;
     }
 
-    ReadStatus ReadString(String* str) {
-        READ_LENGTH
+    /* Allocator-aware elements are built with the container's allocator, so moving them in does not copy */
+    template <class T, class Alloc>
+    static T MakeElement(const Alloc& alloc) {
+        if constexpr (std::uses_allocator_v<T, Alloc> && std::is_constructible_v<T, const Alloc&>) {
+            return T(alloc);
+        } else {
+            return T();
+        }
+    }
+
+    /* Strings from contiguous sources are views into the source; others point into the buffer until cached */
+    struct CachedString {
+        std::string_view view;
+        String owner;
+        /* Dictionary entries take no string number */
+        bool numbered = true;
+    };
+
+    /*
+     * Cached strings of other sources are kept in reusable storage unless a String already owns them.
+     * The ring is a deque, so growing it does not move the storage that views point to.
+     */
+    struct CacheSlot {
+        std::string_view view;
+        String owner;
+        std::string storage;
+    };
+
+    struct EvictedSlot {
+        CacheSlot slot;
+        /* The view pointed to the slot's own storage */
+        bool stored;
+    };
+
+    ReadStatus ReadString(CachedString* str) {
+        int64_t length = 0;
+        if (ReadStatus status = ReadSignedLength(&length); status != kStatusOk) {
+            corrupted_ = true;
+            return status == kStatusReadError ? kStatusReadError : kStatusMalformedData;
+        }
+        str->numbered = true;
         if (length < 0) {
             int64_t index = -length - 1;
-            index -= std::max(string_counter_ - string_cache_size_, 0);
-            if (index < 0 || index >= string_cache_size_) {
+            if (index < dictionary_size_) {
+                OOSF_STATS(++stats_.stats.dictionary_hits;)
+                str->view = dictionary_->At(index);
+                str->owner = nullptr;
+                str->numbered = false;
+                return kStatusOk;
+            }
+            index -= dictionary_size_;
+            const CacheSlot* slot = CachedSlot(index);
+            if (!slot) {
                 corrupted_ = true;
                 return kStatusStringOutOfCache;
             }
 
-            *str = string_cache_[index];
+            OOSF_STATS(++stats_.stats.cache_hits;)
+            OOSF_STATS(int64_t next = string_counter_ + (frames_.empty() ? 0 : frames_.back().strings);)
+            OOSF_STATS(stats_.stats.backref_distance += next - index;)
+            str->view = slot->view;
+            str->owner = slot->owner;
         } else {
-            char* data = new char[length + 1];
-            data[length] = '\0';
-            uint32_t bytes = std::fread(data, 1, length, file_);
-            if (bytes < length) {
-                delete[] data;
+            OOSF_STATS(stats_.stats.cache_misses += string_cache_size_ > 0;)
+            if (ExceedsLimit(length, 1)) {
+                corrupted_ = true;
+                return kStatusLimitExceeded;
+            }
+            if (source_->Data() ? static_cast<uint64_t>(length) > static_cast<uint64_t>(end_ - cur_) : !Fill(length)) {
                 corrupted_ = true;
                 return kStatusReadError;
             }
-            *str = String(data);
+            str->view = std::string_view(cur_, length);
+            str->owner = nullptr;
+            cur_ += length;
         }
         return kStatusOk;
     }
 
-    void UpdateStringCache(String* str) {
-        string_cache_.push_back(*str);
-        while (static_cast<int>(string_cache_.size()) > string_cache_size_) {
-            string_cache_.pop_front();
+    struct ResourceDeleter {
+        std::pmr::memory_resource* resource;
+        size_t size;
+
+        void operator()(char* data) const {
+            resource->deallocate(data, size, 1);
+        }
+    };
+
+    static String MakeString(std::string_view view, std::pmr::memory_resource* resource = nullptr) {
+        String result;
+        char* data;
+        if (!resource) {
+            data = new char[view.size() + 1];
+            result = String(data);
+        } else {
+            data = static_cast<char*>(resource->allocate(view.size() + 1, 1));
+            try {
+                result = String(data, ResourceDeleter{resource, view.size() + 1},
+                                std::pmr::polymorphic_allocator<char>(resource));
+            } catch (...) {
+                resource->deallocate(data, view.size() + 1, 1);
+                throw;
+            }
+        }
+        std::memcpy(data, view.data(), view.size());
+        data[view.size()] = '\0';
+        return result;
+    }
+
+    /*
+     * Numbers past the cached strings name strings of the innermost frame, see kFlagFramedValues. Null if the
+     * number is out of the window.
+     */
+    const CacheSlot* CachedSlot(int64_t index) const {
+        int64_t count = string_counter_;
+        const std::deque<CacheSlot>* ring = &string_cache_;
+        if (index >= string_counter_ && !frames_.empty()) {
+            index -= string_counter_;
+            count = frames_.back().strings;
+            ring = &frame_strings_[frames_.size() - 1];
+        }
+        if (index >= count || index < count - string_cache_size_) {
+            return nullptr;
+        }
+        return &(*ring)[index % string_cache_size_];
+    }
+
+    /* Number the next string takes: among the cached strings, or inside a frame among the frame's own */
+    int& StringCounter() {
+        return frames_.empty() ? string_counter_ : frames_.back().strings;
+    }
+
+    CacheSlot& StringSlot(int number) {
+        if (frame_strings_.size() < frames_.size()) {
+            frame_strings_.resize(frames_.size());
+        }
+        std::deque<CacheSlot>& ring = frames_.empty() ? string_cache_ : frame_strings_[frames_.size() - 1];
+        size_t slot = number % string_cache_size_;
+        if (slot >= ring.size()) {
+            ring.resize(slot + 1);
+        }
+        return ring[slot];
+    }
+
+    /*
+     * The cache is a ring of the last string_cache_size_ strings indexed by string number; it grows on first use.
+     * Each frame depth has a ring of its own.
+     */
+    void UpdateStringCache(const CachedString& str) {
+        if (!str.numbered) {
+            return;
+        }
+        int& counter = StringCounter();
+        if (string_cache_size_ > 0) {
+            CacheSlot& entry = StringSlot(counter);
+            if (keep_evicted_) {
+                bool stored = entry.view.data() == entry.storage.data();
+                evicted_slots_.push_back({std::move(entry), stored});
+                entry = CacheSlot();
+            }
+            OOSF_STATS(stats_.stats.cache_evictions += counter >= string_cache_size_;)
+            if (str.owner || source_->Data()) {
+                entry.view = str.view;
+                entry.owner = str.owner;
+            } else if (entry.view.data() != str.view.data()) {
+                OOSF_STATS(CountGrowth(entry.storage, str.view.size());)
+                entry.storage.assign(str.view);
+                entry.view = entry.storage;
+                entry.owner = nullptr;
+            }
+        }
+        ++counter;
+    }
+
+    /* Takes back the numbers given since StringCounter() was `counter`, putting the evicted strings back */
+    void RestoreStringCache(int counter) {
+        while (!evicted_slots_.empty()) {
+            CacheSlot& entry = StringSlot(counter + evicted_slots_.size() - 1);
+            entry = std::move(evicted_slots_.back().slot);
+            if (evicted_slots_.back().stored) {
+                entry.view = entry.storage;
+            }
+            evicted_slots_.pop_back();
         }
-        ++string_counter_;
+        StringCounter() = counter;
     }
 
+    /* Without a memory resource repeated strings share one String; with one every String comes from it */
     ReadStatus ReadObject(String* str) {
-        ReadStatus status = ReadString(str);
+        CachedString buf;
+        ReadStatus status = ReadString(&buf);
         if (status == kStatusOk) {
-            UpdateStringCache(str);
+            if (resource_) {
+                OOSF_STATS(++stats_.stats.allocations;)
+                *str = MakeString(buf.view, resource_);
+            } else {
+                if (!buf.owner) {
+                    OOSF_STATS(++stats_.stats.allocations;)
+                    buf.owner = MakeString(buf.view);
+                }
+                *str = buf.owner;
+            }
+            UpdateStringCache(buf);
         }
         return status;
     }
 
     inline int GetByte() {
-        return std::fgetc(file_);
+        if (cur_ == end_ && !Fill(1)) {
+            return -1;
+        }
+        return static_cast<unsigned char>(*cur_++);
+    }
+
+    inline bool ReadBytes(void* dst, size_t size) {
+        if (static_cast<size_t>(end_ - cur_) >= size) {
+            std::memcpy(dst, cur_, size);
+            cur_ += size;
+            return true;
+        }
+        return ReadBytesSlow(static_cast<char*>(dst), size);
+    }
+
+    bool ReadBytesSlow(char* dst, size_t size) {
+        size_t available = end_ - cur_;
+        std::memcpy(dst, cur_, available);
+        cur_ += available;
+        dst += available;
+        size -= available;
+
+        if (pinned_ < 0 && size >= kBufferSize && !eof_) {
+            while (size > 0) {
+                size_t bytes = source_->Read(dst, size);
+                if (bytes == 0) {
+                    eof_ = true;
+                    return false;
+                }
+                window_offset_ += (end_ - begin_) + bytes;
+                begin_ = cur_ = end_;
+                dst += bytes;
+                size -= bytes;
+            }
+            return true;
+        }
+
+        if (!Fill(size)) {
+            return false;
+        }
+        std::memcpy(dst, cur_, size);
+        cur_ += size;
+        return true;
+    }
+
+    /*
+     * Makes at least `size` bytes available at cur_, keeping everything after the pinned position. The buffer
+     * only grows as the bytes arrive, so a corrupt length runs into the end of the source instead of allocating.
+     */
+    bool Fill(size_t size) {
+        if (static_cast<size_t>(end_ - cur_) >= size) {
+            return true;
+        }
+        if (eof_) {
+            return false;
+        }
+
+        const char* keep = pinned_ < 0 ? cur_ : begin_ + (pinned_ - window_offset_);
+        size_t offset = cur_ - keep;
+        MoveToBuffer(keep, std::max(buffer_.size(), kBufferSize));
+        while (static_cast<size_t>(end_ - cur_) < size) {
+            if (static_cast<size_t>(end_ - begin_) == buffer_.size()) {
+                MoveToBuffer(begin_, std::min(2 * buffer_.size(), offset + size));
+            }
+            size_t bytes = source_->Read(buffer_.data() + (end_ - begin_), buffer_.size() - (end_ - begin_));
+            if (bytes == 0) {
+                eof_ = true;
+                return false;
+            }
+            end_ += bytes;
+        }
+        return true;
+    }
+
+    /* Moves the buffered bytes from `keep` on to the start of buffer_, growing it to `capacity` */
+    void MoveToBuffer(const char* keep, size_t capacity) {
+        size_t kept = end_ - keep;
+        size_t offset = cur_ - keep;
+        if (capacity > buffer_.size()) {
+            std::vector<char> buffer(capacity);
+            if (kept > 0) {
+                std::memcpy(buffer.data(), keep, kept);
+            }
+            buffer_.swap(buffer);
+        } else if (kept > 0 && keep != buffer_.data()) {
+            std::memmove(buffer_.data(), keep, kept);
+        }
+        window_offset_ += keep - begin_;
+        begin_ = buffer_.data();
+        cur_ = begin_ + offset;
+        end_ = begin_ + kept;
+    }
+
+    /* Long skips over seekable sources jump instead of reading through */
+    bool SkipBytes(uint64_t size) {
+        if (!source_->Data() && pinned_ < 0 && size > static_cast<uint64_t>(end_ - cur_) + kBufferSize) {
+            uint64_t target = Tell() + size;
+            if (target <= source_->Size() && Jump(target)) {
+                return true;
+            }
+        }
+        while (size > 0) {
+            if (cur_ == end_ && !Fill(1)) {
+                return false;
+            }
+            size_t step = std::min<uint64_t>(size, end_ - cur_);
+            cur_ += step;
+            size -= step;
+        }
+        return true;
+    }
+
+    inline int64_t Tell() const {
+        return window_offset_ + (cur_ - begin_);
+    }
+
+    inline void Rewind(int64_t pos) {
+        OOSF_STATS(++stats_.stats.rewinds;)
+        cur_ = begin_ + (pos - window_offset_);
+    }
+
+    /* Positions after the outermost pin stay in the buffer, so type checks can always rewind */
+    inline int64_t Pin() {
+        int64_t previous = pinned_;
+        if (pinned_ < 0) {
+            pinned_ = Tell();
+        }
+        return previous;
+    }
+
+    inline void Unpin(int64_t previous) {
+        pinned_ = previous;
+    }
+
+#ifdef OOSF_ENABLE_STATS
+    /* Values are attributed to the byte they start with */
+    class StatsScope {
+    public:
+        explicit StatsScope(InputDataStream* stream) : stream_(stream) {
+            stream_->stats_.Enter(stream_->PeekByte(), stream_->Tell());
+        }
+
+        ~StatsScope() {
+            stream_->stats_.Leave(stream_->Tell());
+        }
+
+    private:
+        InputDataStream* stream_;
+    };
+
+    template <class Container>
+    void CountGrowth(const Container& container, size_t size) {
+        stats_.stats.allocations += size > container.capacity();
     }
+#endif
 
-    std::FILE* file_;
-    std::deque<String> string_cache_;
+    std::unique_ptr<InputSource> owned_source_;
+    InputSource* source_;
+    std::vector<char> buffer_;
+    const char* begin_ = nullptr;
+    const char* cur_ = nullptr;
+    const char* end_ = nullptr;
+    int64_t window_offset_ = 0;
+    int64_t pinned_ = -1;
+    bool eof_ = false;
+
+    FormatVersion version_ = kFormatV1;
+    int flags_ = 0;
+    std::pmr::memory_resource* resource_ = nullptr;
+    uint64_t max_allocation_ = UINT64_MAX;
+    std::deque<CacheSlot> string_cache_;
+    const StringDictionary* shared_dictionary_ = nullptr;
+    std::unique_ptr<StringDictionary> embedded_dictionary_;
+    const StringDictionary* dictionary_ = nullptr;
+    /* Cache references start after the dictionary indices */
+    int64_t dictionary_size_ = 0;
     int string_cache_size_ = 1;
     int string_counter_ = 0;
     bool corrupted_ = false;
+    ReadStatus header_status_ = kStatusReadError;
+
+    std::vector<uint64_t> record_offsets_;
+    bool index_loaded_ = false;
+
+    OOSF_STATS(StatsRecorder stats_;)
+
 
+    struct ClassEntry {
+        std::string name;
+        const std::type_info* type;
+    };
 
     std::unordered_map<std::type_index, std::string> registered_classes_;
+    std::unordered_map<std::string, const std::type_info*> registered_names_;
+    std::vector<ClassEntry> class_table_;
+
+    std::vector<Frame> frames_;
+    /* Rings of the strings inside the open frames, by depth; a deque, so growing it moves no ring */
+    std::deque<std::deque<CacheSlot>> frame_strings_;
+    std::vector<SkipType> skip_types_;
+    std::vector<CachedString> skip_names_;
+    std::vector<std::string> skip_class_names_;
+    std::vector<char> visit_buffer_;
+    /* Cache slots overwritten while a columnar header is checked, oldest first */
+    std::vector<EvictedSlot> evicted_slots_;
+    bool keep_evicted_ = false;
+
+    template <class T>
+    friend class VectorCursor;
+
+    template <class K, class V>
+    friend class MapCursor;
+};
+
+/* Input range over the elements of a vector opened with InputDataStream::OpenVector */
+template <class T>
+class VectorCursor {
+public:
+    class Iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        explicit Iterator(VectorCursor* cursor = nullptr) : cursor_(cursor) {
+            ++*this;
+        }
+
+        const T& operator*() const {
+            return value_;
+        }
+
+        const T* operator->() const {
+            return &value_;
+        }
+
+        Iterator& operator++() {
+            if (cursor_ && !cursor_->Next(&value_)) {
+                cursor_ = nullptr;
+            }
+            return *this;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return cursor_ == other.cursor_;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return cursor_ != other.cursor_;
+        }
+
+    private:
+        VectorCursor* cursor_;
+        T value_{};
+    };
+
+    VectorCursor() = default;
+
+    VectorCursor(const VectorCursor&) = delete;
+    void operator=(const VectorCursor&) = delete;
+
+    ~VectorCursor() {
+        Close();
+    }
+
+    /* For chunked containers these only cover the chunks read so far */
+    int64_t Size() const {
+        return size_;
+    }
+
+    int64_t Remaining() const {
+        return remaining_;
+    }
+
+    /* Status of the last element read; kStatusOk once the vector is exhausted */
+    ReadStatus Status() const {
+        return status_;
+    }
+
+    /* Returns false at the end of the vector or on an error, see Status() */
+    bool Next(T* value) {
+        if (status_ != kStatusOk || (remaining_ == 0 && !NextChunk())) {
+            return false;
+        }
+        if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+            if (packed_) {
+                if (remaining_ < PackedVectorCodec::kBlockSize && block_pos_ == block_size_) {
+                    int64_t previous = block_size_ > 0 ? block_[block_size_ - 1] : 0;
+                    status_ = in_->ReadPackedTail(&previous);
+                    block_[0] = previous;
+                    block_size_ = 1;
+                    block_pos_ = 0;
+                } else if (block_pos_ == block_size_) {
+                    int64_t previous = block_size_ > 0 ? block_[block_size_ - 1] : 0;
+                    status_ = in_->ReadPackedBlock(previous, block_);
+                    block_size_ = PackedVectorCodec::kBlockSize;
+                    block_pos_ = 0;
+                }
+                if (status_ != kStatusOk) {
+                    return false;
+                }
+                *value = block_[block_pos_++];
+                --remaining_;
+                return true;
+            }
+        }
+        status_ = in_->ReadObject(value);
+        if (status_ != kStatusOk) {
+            in_->corrupted_ = true;
+            return false;
+        }
+        --remaining_;
+        return true;
+    }
+
+    /* Skips the elements left, leaving the stream at the next value */
+    ReadStatus Close() {
+        if (framed_) {
+            /* The rest of a framed vector is jumped over */
+            status_ = in_->EndFrame(status_);
+            remaining_ = 0;
+            framed_ = false;
+        }
+        if constexpr (std::is_arithmetic_v<T>) {
+            if (in_ && !packed_ && !in_->template IsVarint<T>()) {
+                do {
+                    if (status_ == kStatusOk && !in_->SkipBytes(remaining_ * sizeof(T))) {
+                        in_->corrupted_ = true;
+                        status_ = kStatusReadError;
+                    }
+                    remaining_ = 0;
+                } while (status_ == kStatusOk && NextChunk());
+            }
+        }
+        T value{};
+        while (Next(&value)) {
+        }
+        in_ = nullptr;
+        remaining_ = 0;
+        chunked_ = false;
+        return status_;
+    }
+
+    Iterator begin() {
+        return Iterator(this);
+    }
+
+    Iterator end() {
+        return Iterator();
+    }
+
+private:
+    void Open(InputDataStream* in, int64_t size, bool packed, bool chunked, bool framed) {
+        in_ = in;
+        size_ = remaining_ = chunked ? 0 : size;
+        packed_ = packed;
+        chunked_ = chunked;
+        framed_ = framed;
+        status_ = kStatusOk;
+        block_size_ = block_pos_ = 0;
+    }
+
+    /* Chunked vectors continue until an empty chunk */
+    bool NextChunk() {
+        if (!chunked_) {
+            return false;
+        }
+        status_ = in_->ReadContainerLength(&remaining_);
+        size_ += remaining_;
+        if (status_ != kStatusOk || remaining_ == 0) {
+            chunked_ = false;
+            return false;
+        }
+        return true;
+    }
+
+    InputDataStream* in_ = nullptr;
+    int64_t size_ = 0;
+    int64_t remaining_ = 0;
+    bool packed_ = false;
+    bool chunked_ = false;
+    bool framed_ = false;
+    ReadStatus status_ = kStatusOk;
+    int64_t block_[std::is_integral_v<T> ? PackedVectorCodec::kBlockSize : 1];
+    int block_size_ = 0;
+    int block_pos_ = 0;
+
+    friend class InputDataStream;
+};
+
+/* Input range over the entries of a map opened with InputDataStream::OpenMap */
+template <class K, class V>
+class MapCursor {
+public:
+    class Iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::pair<K, V>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        explicit Iterator(MapCursor* cursor = nullptr) : cursor_(cursor) {
+            ++*this;
+        }
+
+        const value_type& operator*() const {
+            return value_;
+        }
+
+        const value_type* operator->() const {
+            return &value_;
+        }
+
+        Iterator& operator++() {
+            if (cursor_ && !cursor_->Next(&value_.first, &value_.second)) {
+                cursor_ = nullptr;
+            }
+            return *this;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return cursor_ == other.cursor_;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return cursor_ != other.cursor_;
+        }
+
+    private:
+        MapCursor* cursor_;
+        value_type value_{};
+    };
+
+    MapCursor() = default;
+
+    MapCursor(const MapCursor&) = delete;
+    void operator=(const MapCursor&) = delete;
+
+    ~MapCursor() {
+        Close();
+    }
+
+    /* For chunked containers these only cover the chunks read so far */
+    int64_t Size() const {
+        return size_;
+    }
+
+    int64_t Remaining() const {
+        return remaining_;
+    }
+
+    ReadStatus Status() const {
+        return status_;
+    }
+
+    bool Next(K* key, V* value) {
+        if (status_ != kStatusOk || (remaining_ == 0 && !NextChunk())) {
+            return false;
+        }
+        if ((status_ = in_->ReadObject(key)) != kStatusOk || (status_ = in_->ReadObject(value)) != kStatusOk) {
+            in_->corrupted_ = true;
+            return false;
+        }
+        --remaining_;
+        return true;
+    }
+
+    ReadStatus Close() {
+        if (framed_) {
+            status_ = in_->EndFrame(status_);
+            remaining_ = 0;
+            framed_ = false;
+        }
+        K key{};
+        V value{};
+        while (Next(&key, &value)) {
+        }
+        in_ = nullptr;
+        remaining_ = 0;
+        chunked_ = false;
+        return status_;
+    }
+
+    Iterator begin() {
+        return Iterator(this);
+    }
+
+    Iterator end() {
+        return Iterator();
+    }
+
+private:
+    void Open(InputDataStream* in, int64_t size, bool chunked, bool framed) {
+        in_ = in;
+        size_ = remaining_ = size;
+        chunked_ = chunked;
+        framed_ = framed;
+        status_ = kStatusOk;
+    }
+
+    bool NextChunk() {
+        if (!chunked_) {
+            return false;
+        }
+        status_ = in_->ReadContainerLength(&remaining_);
+        size_ += remaining_;
+        if (status_ != kStatusOk || remaining_ == 0) {
+            chunked_ = false;
+            return false;
+        }
+        return true;
+    }
+
+    InputDataStream* in_ = nullptr;
+    int64_t size_ = 0;
+    int64_t remaining_ = 0;
+    bool chunked_ = false;
+    bool framed_ = false;
+    ReadStatus status_ = kStatusOk;
+
+    friend class InputDataStream;
 };
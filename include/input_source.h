@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+class InputSource {
+public:
+    virtual size_t Read(char* buffer, size_t size) = 0;
+
+    /* Sources backed by contiguous memory are decoded in place, without copying into a buffer */
+    virtual const char* Data() const {
+        return nullptr;
+    }
+
+    /* Total size in bytes, 0 if unknown */
+    virtual size_t Size() const {
+        return 0;
+    }
+
+    /* Moves the read position to an absolute offset; sources that cannot seek return false */
+    virtual bool Seek(uint64_t) {
+        return false;
+    }
+
+    virtual ~InputSource() = default;
+};
+
+class FileInputSource : public InputSource {
+public:
+    explicit FileInputSource(std::FILE* file) : file_(file) {
+    }
+
+    size_t Read(char* buffer, size_t size) override {
+        return std::fread(buffer, 1, size, file_);
+    }
+
+    size_t Size() const override {
+        struct stat info;
+        int fd = ::fileno(file_);
+        return fd >= 0 && ::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) ? info.st_size : 0;
+    }
+
+    bool Seek(uint64_t offset) override {
+        return ::fseeko(file_, offset, SEEK_SET) == 0;
+    }
+
+private:
+    std::FILE* file_;
+};
+
+class FdInputSource : public InputSource {
+public:
+    explicit FdInputSource(int fd) : fd_(fd) {
+    }
+
+    size_t Read(char* buffer, size_t size) override {
+        while (true) {
+            ssize_t bytes = ::read(fd_, buffer, size);
+            if (bytes >= 0) {
+                return bytes;
+            }
+            if (errno != EINTR) {
+                return 0;
+            }
+        }
+    }
+
+    size_t Size() const override {
+        struct stat info;
+        return ::fstat(fd_, &info) == 0 && S_ISREG(info.st_mode) ? info.st_size : 0;
+    }
+
+    bool Seek(uint64_t offset) override {
+        return ::lseek(fd_, offset, SEEK_SET) >= 0;
+    }
+
+private:
+    int fd_;
+};
+
+class MemoryInputSource : public InputSource {
+public:
+    MemoryInputSource(const char* data, size_t size) : data_(data), size_(size) {
+    }
+
+    size_t Read(char* buffer, size_t size) override {
+        size = std::min(size, size_ - pos_);
+        std::memcpy(buffer, data_ + pos_, size);
+        pos_ += size;
+        return size;
+    }
+
+    const char* Data() const override {
+        return data_;
+    }
+
+    size_t Size() const override {
+        return size_;
+    }
+
+    bool Seek(uint64_t offset) override {
+        if (offset > size_) {
+            return false;
+        }
+        pos_ = offset;
+        return true;
+    }
+
+private:
+    const char* data_;
+    size_t size_;
+    size_t pos_ = 0;
+};
+
+/* Strings and vector views read from a mapped file point into the mapping and live as long as this object */
+class MappedFileInputSource : public InputSource {
+public:
+    explicit MappedFileInputSource(const char* path) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* data = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                ::madvise(data, info.st_size, MADV_SEQUENTIAL);
+                data_ = static_cast<const char*>(data);
+                size_ = info.st_size;
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFileInputSource() {
+        if (data_) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    MappedFileInputSource(const MappedFileInputSource&) = delete;
+    void operator=(const MappedFileInputSource&) = delete;
+
+    operator bool() const {
+        return data_ != nullptr;
+    }
+
+    size_t Read(char* buffer, size_t size) override {
+        size = std::min(size, size_ - pos_);
+        std::memcpy(buffer, data_ + pos_, size);
+        pos_ += size;
+        return size;
+    }
+
+    const char* Data() const override {
+        return data_;
+    }
+
+    size_t Size() const override {
+        return size_;
+    }
+
+    bool Seek(uint64_t offset) override {
+        if (offset > size_) {
+            return false;
+        }
+        pos_ = offset;
+        return true;
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t pos_ = 0;
+};
@@ -7,8 +7,13 @@
 #include <string>
 #include <unordered_map>
 #include <map>
+#include <array>
+#include <tuple>
+#include <utility>
 #include <string_view>
+#include <cstring>
 #include <queue>
+#include <deque>
 #include <type_traits>
 #include <typeinfo>
 #include <unordered_set>
@@ -16,29 +21,186 @@
 #include <sstream>
 #include <exception>
 #include <iostream>
+#include <iterator>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "output_sink.h"
+#include "packed_vector.h"
+#include "xor_compression.h"
+#include "type_signature.h"
+#include "string_cache.h"
+#include "string_dictionary.h"
+#include "stream_stats.h"
+#include "struct_fields.h"
 #include "log.h"
 
+template <class T>
+class VectorWriter;
+
+template <class K, class V>
+class MapWriter;
+
 class OutputDataStream {
 public:
-    explicit OutputDataStream(std::ostream* out, int string_cache_size = 0)
-        : out_(out), string_counter_(0), string_cache_size_(string_cache_size) {
-        last_occurence_.reserve(string_cache_size + 2);
+    static constexpr size_t kChunkSize = 1024;
 
-        /* Signature */
-        Write("OOSFv1");
-        WriteMinimal(string_cache_size_);
+    /*
+     * Strings found in `dictionary`, which has to outlive the stream, are written as its indices. Readers have
+     * to be given the same dictionary, unless `flags` has kFlagEmbeddedDictionary to copy it into the header.
+     */
+    explicit OutputDataStream(std::ostream* out, int string_cache_size = 0,
+                              FormatVersion version = kFormatV1, int flags = 0,
+                              const StringDictionary* dictionary = nullptr)
+        : out_(out), owned_sink_(new OstreamOutputSink(out)), sink_(owned_sink_.get()),
+          string_counter_(0), string_cache_size_(string_cache_size), version_(version), flags_(flags),
+          string_cache_(string_cache_size), dictionary_(dictionary) {
+        WriteHeader();
+    }
+
+    explicit OutputDataStream(OutputSink* sink, int string_cache_size = 0,
+                              FormatVersion version = kFormatV1, int flags = 0,
+                              const StringDictionary* dictionary = nullptr)
+        : out_(nullptr), sink_(sink), string_counter_(0), string_cache_size_(string_cache_size),
+          version_(version), flags_(flags), string_cache_(string_cache_size), dictionary_(dictionary) {
+        WriteHeader();
     }
 
     ~OutputDataStream() {
+        try {
+            Close();
+        } catch (const std::exception&) {
+        }
     }
 
     OutputDataStream(const OutputDataStream&) = delete;
     void operator=(const OutputDataStream&) = delete;
 
+    /* Buffered bytes are flushed first, so the caller may write to the stream directly */
     std::ostream* GetStream() {
+        Flush();
         return out_;
     }
 
+    OutputSink* GetSink() {
+        return sink_;
+    }
+
+    void Flush() {
+        sink_->Flush();
+    }
+
+    /*
+     * Starts an independent record: strings and classes are never referenced across records, so a reader
+     * can start decoding at any of them. Streams with records end with an index of their offsets.
+     */
+    void BeginRecord() {
+        record_offsets_.push_back(sink_->Position());
+        WriteByte(TYPE_RECORD);
+        ResetRecordState();
+    }
+
+    /*
+     * Writes `count` records, encoding them concurrently on `threads` threads (all cores by default):
+     * encode(i, stream) fills record i through a private stream with the same settings and classes.
+     * Records are appended in order as soon as each one is ready, so at most one record per thread is
+     * buffered. The first exception thrown by `encode` is rethrown once all threads stop.
+     */
+    template <class Encode>
+    void WriteRecordsParallel(size_t count, Encode encode, int threads = 0) {
+        if (threads <= 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        threads = std::min<size_t>(threads, std::max<size_t>(count, 1));
+
+        std::mutex mutex;
+        std::condition_variable turn;
+        size_t next = 0;
+        size_t written = 0;
+        std::exception_ptr error;
+
+        /* Segment streams copy the settings of this one, so they are made before any record is appended */
+        std::deque<MemoryOutputSink> sinks(threads);
+        std::vector<std::unique_ptr<OutputDataStream>> segments;
+        for (auto& sink : sinks) {
+            segments.emplace_back(new OutputDataStream(&sink, *this));
+        }
+
+        auto worker = [&](MemoryOutputSink& sink, OutputDataStream& segment) {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!error && next < count) {
+                size_t index = next++;
+                lock.unlock();
+                try {
+                    sink.Clear();
+                    segment.ResetRecordState();
+                    encode(index, &segment);
+                } catch (...) {
+                    lock.lock();
+                    error = error ? error : std::current_exception();
+                    turn.notify_all();
+                    return;
+                }
+                lock.lock();
+                turn.wait(lock, [&] { return error || written == index; });
+                if (error) {
+                    return;
+                }
+                try {
+                    AppendRecord(segment, sink.Data(), sink.Size(), index + 1 == count);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                ++written;
+                turn.notify_all();
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (int i = 1; i < threads; ++i) {
+            pool.emplace_back(worker, std::ref(sinks[i]), std::ref(*segments[i]));
+        }
+        worker(sinks[0], *segments[0]);
+        for (auto& thread : pool) {
+            thread.join();
+        }
+        OOSF_STATS(for (auto& segment : segments) stats_.stats.Merge(segment->GetStats());)
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    /* Writes the record index, if there are records, and flushes; nothing may be written afterwards */
+    void Close() {
+        if (!closed_ && !record_offsets_.empty()) {
+            uint64_t index = sink_->Position();
+            WriteByte(TYPE_INDEX);
+            WriteLength(record_offsets_.size());
+            for (uint64_t offset : record_offsets_) {
+                WriteLength(index - offset);
+            }
+            uint64_t distance = sink_->Position() - index;
+            WriteBytes(&distance);
+            WriteBytes(INDEX_MAGIC, INDEX_TRAILER_SIZE - sizeof(distance));
+        }
+        closed_ = true;
+        Flush();
+    }
+
+#ifdef OOSF_ENABLE_STATS
+    /* Rewinds and seeks stay zero on the writer */
+    StreamStats GetStats() const {
+        StreamStats stats = stats_.stats;
+        stats.cache_evictions += string_cache_.Evictions();
+        stats.allocations += string_cache_.Allocations();
+        for (const FrameStrings& strings : frame_strings_) {
+            stats.cache_evictions += strings.cache.Evictions();
+            stats.allocations += strings.cache.Allocations();
+        }
+        return stats;
+    }
+#endif
+
     template <class T>
     bool RegisterClass(const std::string& str) {
         auto type_index = std::type_index(typeid(std::decay_t<T>));
@@ -46,50 +208,249 @@ public:
         if (iter != registered_classes_.end()) {
             return false;
         }
-        registered_classes_[type_index] = str;
+        registered_classes_[type_index].name = str;
         return true;
     }
 
+    /* Types described with OOSF_REFLECT are registered under their own name */
+    template <class T>
+    bool RegisterClass() {
+        return RegisterClass<T>(StructFields<std::decay_t<T>>::kName);
+    }
+
     template <class T>
     void Write(const T& value) {
+        OOSF_STATS(StatsScope stats_scope(this, TagOf<T>());)
         WriteType<T>();
-        WriteValue(value);
+        if constexpr (IsComposite<T>::value) {
+            FrameScope frame(this);
+            WriteValue(value);
+            frame.Close();
+        } else {
+            WriteValue(value);
+        }
     }
 
     void Write(bool value) {
+        OOSF_STATS(StatsScope stats_scope(this, value ? TYPE_BOOL_T : TYPE_BOOL_F);)
         WriteByte(value ? '+' : '-');
     }
 
+    /* Single-pass ranges of unknown size are written chunked, see WriteAsChunkedVector */
     template <class Iter>
     void WriteAsVector(Iter begin, Iter end, int size = -1) {
         if (size < 0) {
+            if constexpr (IsSinglePass<Iter>::value) {
+                WriteAsChunkedVector(begin, end);
+                return;
+            }
             size = std::distance(begin, end);
         }
 
+        OOSF_STATS(StatsScope stats_scope(this, TYPE_VECTOR);)
         using ValueType = typename std::iterator_traits<Iter>::value_type;
         WriteType<std::vector<ValueType>>();
+        FrameScope frame(this);
         WriteAsVectorInternal(begin, size);
+        frame.Close();
     }
 
     template <class Iter>
     void WriteAsMap(Iter begin, Iter end, int size = -1) {
         if (size < 0) {
+            if constexpr (IsSinglePass<Iter>::value) {
+                WriteAsChunkedMap(begin, end);
+                return;
+            }
             size = std::distance(begin, end);
         }
 
+        OOSF_STATS(StatsScope stats_scope(this, TYPE_MAP);)
         using Pair = typename std::iterator_traits<Iter>::value_type;
         using KeyType = typename Pair::first_type;
         using ValueType = typename Pair::second_type;
         WriteType<std::map<KeyType, ValueType>>();
+        FrameScope frame(this);
         WriteAsMapInternal(begin, size);
+        frame.Close();
+    }
+    /*
+     * Columnar map encoding: all keys, then all values, so arithmetic columns are copied in bulk on both ends.
+     * Read back as any map type; std::map and FlatMap load sorted input in linear time.
+     */
+    template <class Iter>
+    void WriteAsColumnarMap(Iter begin, Iter end, int size = -1) {
+        static_assert(!IsSinglePass<Iter>::value, "Columnar maps need a multi-pass range");
+        if (size < 0) {
+            size = std::distance(begin, end);
+        }
+
+        using Pair = typename std::iterator_traits<Iter>::value_type;
+        OOSF_STATS(StatsScope stats_scope(this, TYPE_COLUMNAR_MAP);)
+        WriteByte(TYPE_COLUMNAR_MAP);
+        WriteType<std::remove_const_t<typename Pair::first_type>>();
+        WriteType<typename Pair::second_type>();
+        WriteLength(size);
+
+        using ValueType = typename Pair::second_type;
+        if constexpr (IsBulkCopyable<ValueType>::value) {
+            if (!IsVarint<ValueType>()) {
+                /* Walking a node-based map twice costs more than setting raw values aside while the keys go out */
+                column_buffer_.resize(size * sizeof(ValueType));
+                char* values = column_buffer_.data();
+                WriteColumn(begin, size, [&values](const Pair& entry) -> const auto& {
+                    std::memcpy(values, &entry.second, sizeof(ValueType));
+                    values += sizeof(ValueType);
+                    return entry.first;
+                });
+                WriteBytes(column_buffer_.data(), column_buffer_.size());
+                return;
+            }
+        }
+        WriteColumn(begin, size, [](const Pair& entry) -> const auto& { return entry.first; });
+        WriteColumn(begin, size, [](const Pair& entry) -> const auto& { return entry.second; });
     }
-/*
+    /*
+     * Struct-of-arrays encoding for ranges of registered structs with StructFields: each field is written as
+     * one contiguous column, so arithmetic fields are copied in bulk and no element goes through WriteValue().
+     * Read back into std::vector<T> or StructColumns<T>.
+     */
+    template <class Iter>
+    void WriteAsColumnarVector(Iter begin, Iter end, int size = -1) {
+        using ValueType = typename std::iterator_traits<Iter>::value_type;
+        static_assert(HasStructFields<ValueType>::value, "Columnar vectors need StructFields");
+        static_assert(!IsSinglePass<Iter>::value, "Columnar vectors need a multi-pass range");
+        if (size < 0) {
+            size = std::distance(begin, end);
+        }
+
+        OOSF_STATS(StatsScope stats_scope(this, TYPE_COLUMNAR_VECTOR);)
+        WriteByte(TYPE_COLUMNAR_VECTOR);
+        WriteType<ValueType>();
+        WriteMinimal(kFieldCount<ValueType>);
+        ForEachField<ValueType>([this](auto member) {
+            WriteType<typename MemberType<decltype(member)>::type>();
+        });
+        WriteLength(size);
+        ForEachField<ValueType>([&](auto member) {
+            WriteColumn(begin, size, [member](const ValueType& value) -> const auto& { return value.*member; });
+        });
+    }
+    /* Delta / frame-of-reference bit-packed encoding for integer vectors, see packed_vector.h */
+    template <class Iter>
+    void WriteAsPackedVector(Iter begin, Iter end, int size = -1) {
+        if (size < 0) {
+            size = std::distance(begin, end);
+        }
+
+        using ValueType = typename std::iterator_traits<Iter>::value_type;
+        static_assert(std::is_integral_v<ValueType> && !std::is_same_v<ValueType, bool>,
+                      "Only integer vectors can be packed");
+        OOSF_STATS(StatsScope stats_scope(this, TYPE_PACKED_VECTOR);)
+        WriteByte(TYPE_PACKED_VECTOR);
+        WriteType<ValueType>();
+        WriteLength(size);
+
+        int64_t block[PackedVectorCodec::kBlockSize];
+        int64_t previous = 0;
+        for (; size >= PackedVectorCodec::kBlockSize; size -= PackedVectorCodec::kBlockSize) {
+            for (int i = 0; i < PackedVectorCodec::kBlockSize; ++i, ++begin) {
+                block[i] = *begin;
+            }
+            char* ptr = sink_->Reserve(PackedVectorCodec::kMaxBlockBytes);
+            sink_->Commit(ptr + PackedVectorCodec::EncodeBlock(block, previous, ptr));
+            previous = block[PackedVectorCodec::kBlockSize - 1];
+        }
+        /* The tail is shorter than a block and is written as varint deltas */
+        for (; size > 0; --size, ++begin) {
+            int64_t value = *begin;
+            WriteVarint(ZigZag(static_cast<uint64_t>(value) - static_cast<uint64_t>(previous)));
+            previous = value;
+        }
+    }
+    /* XOR-with-previous compression for float and double vectors, see xor_compression.h */
+    template <class Iter>
+    void WriteAsCompressedVector(Iter begin, Iter end, int size = -1) {
+        if (size < 0) {
+            size = std::distance(begin, end);
+        }
+
+        using ValueType = typename std::iterator_traits<Iter>::value_type;
+        static_assert(std::is_floating_point_v<ValueType>, "Only floating point vectors can be compressed");
+        OOSF_STATS(StatsScope stats_scope(this, TYPE_XOR_VECTOR);)
+        OOSF_STATS(size_t capacity = compression_buffer_.capacity();)
+        if constexpr (IsContiguousIterator<Iter>::value) {
+            XorFloatCodec<ValueType>::Encode(size > 0 ? &*begin : nullptr, size, &compression_buffer_);
+        } else {
+            /* Other ranges are copied to an array first */
+            std::vector<ValueType> values(begin, std::next(begin, size));
+            XorFloatCodec<ValueType>::Encode(values.data(), values.size(), &compression_buffer_);
+            OOSF_STATS(stats_.stats.allocations += size > 0;)
+        }
+        OOSF_STATS(stats_.stats.allocations += compression_buffer_.capacity() != capacity;)
+
+        WriteByte(TYPE_XOR_VECTOR);
+        WriteType<ValueType>();
+        WriteLength(size);
+        WriteLength(compression_buffer_.size());
+        WriteBytes(compression_buffer_.data(), compression_buffer_.size());
+    }
+    /*
+     * Chunked encoding for sequences of unknown length: the elements go out in counted chunks of at most
+     * `chunk_size` elements followed by an empty chunk, so only one chunk is buffered at a time.
+     * Read back as a plain vector or map, or element by element with a cursor.
+     */
+    template <class Iter>
+    void WriteAsChunkedVector(Iter begin, Iter end, size_t chunk_size = kChunkSize) {
+        OOSF_STATS(StatsScope stats_scope(this, TYPE_CHUNKED_VECTOR);)
+        VectorWriter<typename std::iterator_traits<Iter>::value_type> writer;
+        BeginVector(&writer, chunk_size);
+        for (; begin != end; ++begin) {
+            writer.Write(*begin);
+        }
+        writer.Close();
+    }
+
+    template <class Iter>
+    void WriteAsChunkedMap(Iter begin, Iter end, size_t chunk_size = kChunkSize) {
+        OOSF_STATS(StatsScope stats_scope(this, TYPE_CHUNKED_MAP);)
+        using Pair = typename std::iterator_traits<Iter>::value_type;
+        MapWriter<std::remove_const_t<typename Pair::first_type>, typename Pair::second_type> writer;
+        BeginMap(&writer, chunk_size);
+        for (; begin != end; ++begin) {
+            writer.Write(begin->first, begin->second);
+        }
+        writer.Close();
+    }
+
+    /* Starts a chunked vector whose elements are passed to `writer` one by one until it is closed */
+    template <class T>
+    void BeginVector(VectorWriter<T>* writer, size_t chunk_size = kChunkSize) {
+        writer->Close();
+        WriteByte(TYPE_CHUNKED_VECTOR);
+        WriteType<T>();
+        writer->Open(this, chunk_size);
+    }
+
+    template <class K, class V>
+    void BeginMap(MapWriter<K, V>* writer, size_t chunk_size = kChunkSize) {
+        writer->Close();
+        WriteByte(TYPE_CHUNKED_MAP);
+        WriteType<K>();
+        WriteType<V>();
+        writer->Open(this, chunk_size);
+    }
+
+    /* A fixed-arity heterogeneous record, read back as std::tuple (or std::pair) of the same element types */
     template <class... Args>
     void WriteAsTuple(const Args&... args) {
-        WriteType<std::tuple<Args...>>();
+        OOSF_STATS(StatsScope stats_scope(this, TYPE_TUPLE);)
+        WriteType<std::tuple<std::decay_t<Args>...>>();
+        FrameScope frame(this);
         (WriteValue(args), ...);
+        frame.Close();
     }
-*/
+
     void WriteMinimal(int64_t value) {
 #define TRY(size) if (value < (1LL << ( size - 1)) && -(1LL << (size - 1)) <= value) {   \
     Write(static_cast<int##size##_t>(value));                               \
@@ -102,6 +463,251 @@ public:
     }
 
 private:
+    struct RegisteredClass {
+        std::string name;
+        int64_t id = -1;
+    };
+
+    /* An open frame: where its size goes, the class declarations to forget when it ends and its first string */
+    struct Frame {
+        uint64_t position;
+        size_t declared;
+        int64_t next_class_id;
+        int64_t strings;
+    };
+
+    /* Strings of the frames at one depth, numbered on across them; a frame only refers to its own */
+    struct FrameStrings {
+        explicit FrameStrings(int capacity) : cache(capacity) {
+        }
+
+        StringCache cache;
+        int64_t counter = 0;
+    };
+
+    /*
+     * Frames the payload written while it is open in streams with kFlagFramedValues. The size is patched in
+     * by Close(); a frame left by an exception is only released.
+     */
+    class FrameScope {
+    public:
+        explicit FrameScope(OutputDataStream* stream)
+            : stream_(stream->flags_ & kFlagFramedValues ? stream : nullptr) {
+            if (stream_) {
+                stream_->BeginFrame();
+            }
+        }
+
+        ~FrameScope() {
+            if (stream_) {
+                stream_->sink_->Release();
+                stream_->EndFrame();
+            }
+        }
+
+        void Close() {
+            if (stream_) {
+                stream_->PatchFrameSize();
+            }
+        }
+
+    private:
+        OutputDataStream* stream_;
+    };
+
+    void BeginFrame() {
+        uint64_t position = sink_->Hold();
+        uint32_t size = 0;
+        WriteBytes(&size);
+        if (frame_strings_.size() == frames_.size()) {
+            frame_strings_.emplace_back(string_cache_size_);
+        }
+        frames_.push_back({position, frame_classes_.size(), next_class_id_, frame_strings_[frames_.size()].counter});
+    }
+
+    void PatchFrameSize() {
+        uint64_t size = sink_->Position() - frames_.back().position - sizeof(uint32_t);
+        if (size > UINT32_MAX) {
+            throw std::runtime_error("Framed value exceeds 4 GiB");
+        }
+        uint32_t value = size;
+        sink_->Patch(frames_.back().position, &value, sizeof(value));
+    }
+
+    /* Readers that jump over the frame never see the classes declared inside it */
+    void EndFrame() {
+        const Frame& frame = frames_.back();
+        for (size_t i = frame.declared; i < frame_classes_.size(); ++i) {
+            frame_classes_[i]->id = -1;
+        }
+        frame_classes_.resize(frame.declared);
+        next_class_id_ = frame.next_class_id;
+        frames_.pop_back();
+    }
+
+    /* Headerless stream for encoding records of `parent` on another thread */
+    OutputDataStream(OutputSink* sink, const OutputDataStream& parent)
+        : out_(nullptr), sink_(sink), string_counter_(0), string_cache_size_(parent.string_cache_size_),
+          version_(parent.version_), flags_(parent.flags_), string_cache_(parent.string_cache_size_),
+          dictionary_(parent.dictionary_), dictionary_size_(parent.dictionary_size_),
+          registered_classes_(parent.registered_classes_) {
+    }
+
+#ifdef OOSF_ENABLE_STATS
+    class StatsScope {
+    public:
+        StatsScope(OutputDataStream* stream, char tag) : stream_(stream) {
+            stream_->stats_.Enter(static_cast<unsigned char>(tag), stream_->sink_->Position());
+        }
+
+        ~StatsScope() {
+            stream_->stats_.Leave(stream_->sink_->Position());
+        }
+
+    private:
+        OutputDataStream* stream_;
+    };
+
+    /* The first byte Write<T>() puts out */
+    template <class T>
+    static constexpr char TagOf() {
+        using Type = std::decay_t<T>;
+        if constexpr (TypeSignature<Type>::kSupported) {
+            return TypeSignature<Type>::type::value[0];
+        } else if constexpr (std::is_base_of_v<Serializable, Type> || IsReflected<Type>::value) {
+            return TYPE_STRUCT;
+        } else if constexpr (IsTuple<Type>::value || IsPair<Type>::value) {
+            return TYPE_TUPLE;
+        } else if constexpr (IsVector<Type>::value || IsArray<Type>::value || IsSpan<Type>::value) {
+            return TYPE_VECTOR;
+        } else if constexpr (IsMap<Type>::value || IsUnorderedMap<Type>::value || IsFlatMap<Type>::value) {
+            return TYPE_MAP;
+        } else {
+            return TYPE_STRING;
+        }
+    }
+#endif
+
+    void ResetRecordState() {
+        record_base_ = string_counter_;
+        next_class_id_ = 0;
+        for (auto& [type, info] : registered_classes_) {
+            info.id = -1;
+        }
+    }
+
+    /*
+     * Appends a record encoded by another stream. After the last one this stream continues that record,
+     * so it takes over its string numbering and class ids.
+     */
+    void AppendRecord(const OutputDataStream& segment, const char* data, size_t size, bool last) {
+        record_offsets_.push_back(sink_->Position());
+        WriteByte(TYPE_RECORD);
+        sink_->Write(data, size);
+        if (last) {
+            int64_t strings = segment.string_counter_ - segment.record_base_;
+            string_counter_ += strings;
+            record_base_ = string_counter_ - strings;
+            next_class_id_ = segment.next_class_id_;
+            for (auto& [type, info] : registered_classes_) {
+                info.id = segment.registered_classes_.at(type).id;
+            }
+        }
+    }
+
+    void WriteHeader() {
+        if (version_ == kFormatV1) {
+            if (flags_ != 0 || dictionary_) {
+                throw std::runtime_error("Format flags require OOSFv2");
+            }
+            /* Signature */
+            Write("OOSFv1");
+            WriteMinimal(string_cache_size_);
+            return;
+        }
+
+        if ((flags_ & ~kKnownFlags) != 0) {
+            throw std::runtime_error("Unknown format flags");
+        }
+        /* The signature itself is always encoded the OOSFv1 way, so readers can tell versions apart */
+        version_ = kFormatV1;
+        Write("OOSFv2");
+        version_ = kFormatV2;
+        if (dictionary_ && !(flags_ & kFlagEmbeddedDictionary)) {
+            flags_ |= kFlagSharedDictionary;
+        }
+        int dictionary_flags = flags_ & (kFlagSharedDictionary | kFlagEmbeddedDictionary);
+        if ((dictionary_flags != 0) != (dictionary_ != nullptr) ||
+                dictionary_flags == (kFlagSharedDictionary | kFlagEmbeddedDictionary)) {
+            throw std::runtime_error("Dictionary flags need a dictionary and exclude each other");
+        }
+        WriteByte(flags_);
+        WriteLength(string_cache_size_);
+        if (dictionary_) {
+            WriteLength(dictionary_->Size());
+            if (flags_ & kFlagSharedDictionary) {
+                uint64_t fingerprint = dictionary_->Fingerprint();
+                WriteBytes(&fingerprint);
+            } else {
+                for (const std::string& entry : dictionary_->Entries()) {
+                    HonestWriteString(entry);
+                }
+            }
+            dictionary_size_ = dictionary_->Size();
+        }
+    }
+
+    /* Lengths and cache references: tagged minimal integers in OOSFv1, LEB128 varints in OOSFv2 */
+    void WriteLength(uint64_t value) {
+        if (version_ == kFormatV1) {
+            WriteMinimal(value);
+        } else {
+            WriteVarint(value);
+        }
+    }
+
+    void WriteSignedLength(int64_t value) {
+        if (version_ == kFormatV1) {
+            WriteMinimal(value);
+        } else {
+            WriteVarint(ZigZag(value));
+        }
+    }
+
+    static inline uint64_t ZigZag(int64_t value) {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    inline void WriteVarint(uint64_t value) {
+        char* ptr = sink_->Reserve(10);
+        while (value >= 0x80) {
+            *ptr++ = static_cast<char>(value | 0x80);
+            value >>= 7;
+        }
+        *ptr++ = static_cast<char>(value);
+        sink_->Commit(ptr);
+    }
+
+    /* OOSFv2 declares a class as (id << 1 | 1) + name on first use and refers to it as (id << 1) afterwards */
+    void WriteClassId(RegisteredClass* info) {
+        if (info->id >= 0) {
+            WriteVarint(info->id << 1);
+            return;
+        }
+        info->id = next_class_id_++;
+        if (!frames_.empty()) {
+            frame_classes_.push_back(info);
+        }
+        WriteVarint(info->id << 1 | 1);
+        WriteLength(info->name.size());
+        WriteBytes(info->name.data(), info->name.size());
+    }
+
+    template <class T>
+    inline bool IsVarint() const {
+        return std::is_integral_v<T> && sizeof(T) > 1 && (flags_ & kFlagVarintIntegers);
+    }
+
     template <class T>
     void WriteType() {
 #define WRITE_TYPE(type, symbol)                                \
@@ -109,6 +715,10 @@ if constexpr (std::is_same_v<type, T> ||                        \
         IsSameIntegral<type, T>::value) {                       \
     WriteByte(symbol);                                          \
 } else
+        if constexpr (TypeSignature<std::decay_t<T>>::kSupported) {
+            using Signature = typename TypeSignature<std::decay_t<T>>::type;
+            WriteBytes(Signature::value, Signature::size);
+        } else
         WRITE_TYPE(std::int8_t  , TYPE_INT8     )
         WRITE_TYPE(std::int16_t , TYPE_INT16    )
         WRITE_TYPE(std::int32_t , TYPE_INT32    )
@@ -118,7 +728,7 @@ if constexpr (std::is_same_v<type, T> ||                        \
         WRITE_TYPE(bool         , TYPE_BOOL     )
         WRITE_TYPE(std::string  , TYPE_STRING   )
 
-        if constexpr (std::is_base_of_v<Serializable, std::decay_t<T>>) {
+        if constexpr (std::is_base_of_v<Serializable, std::decay_t<T>> || IsReflected<std::decay_t<T>>::value) {
             auto type_index = std::type_index(typeid(std::decay_t<T>));
             auto iter = registered_classes_.find(type_index);
             if (iter == registered_classes_.end()) {
@@ -126,15 +736,20 @@ if constexpr (std::is_same_v<type, T> ||                        \
             }
 
             WriteByte(TYPE_STRUCT);
-            WriteValue(iter->second);
-        } else if constexpr (std::is_same_v<std::decay_t<T>, char*> || std::is_same_v<std::decay_t<T>, std::string>) {
+            if (version_ == kFormatV1) {
+                WriteValue(iter->second.name);
+            } else {
+                WriteClassId(&iter->second);
+            }
+        } else if constexpr (std::is_same_v<std::decay_t<T>, char*> || std::is_same_v<std::decay_t<T>, std::string> ||
+                             std::is_same_v<std::decay_t<T>, std::string_view>) {
             WriteByte(TYPE_STRING);
- /*       } else if constexpr (IsTuple<T>::value) {
-            WriteTupleType(static_cast<T*>(nullptr));*/
-        } else if constexpr (IsVector<T>::value) {
+        } else if constexpr (IsTuple<T>::value || IsPair<T>::value) {
+            WriteTupleType(static_cast<T*>(nullptr));
+        } else if constexpr (IsVector<T>::value || IsArray<T>::value || IsSpan<T>::value) {
             WriteByte(TYPE_VECTOR);
             WriteType<typename T::value_type>();
-        } else if constexpr (IsMap<T>::value) {
+        } else if constexpr (IsMap<T>::value || IsUnorderedMap<T>::value || IsFlatMap<T>::value) {
             WriteByte(TYPE_MAP);
             WriteType<typename T::key_type>();
             WriteType<typename T::mapped_type>();
@@ -153,96 +768,231 @@ if constexpr (std::is_same_v<type, T> ||                        \
     template <class... Args> \
     class name<type<Args...>> : public std::true_type {};
 
-//    TYPE_CHECKER(IsTuple,   std::tuple  )
+    TYPE_CHECKER(IsTuple,   std::tuple  )
+    TYPE_CHECKER(IsPair,    std::pair   )
     TYPE_CHECKER(IsVector,  std::vector )
     TYPE_CHECKER(IsMap,     std::map    )
+    TYPE_CHECKER(IsUnorderedMap, std::unordered_map)
+    TYPE_CHECKER(IsFlatMap, FlatMap)
 
 #undef TYPE_CHECKER
-/*
+
+    /* Fixed-size arrays and spans are written as vectors */
+    template <class T>
+    class IsArray : public std::false_type {};
+
+    template <class T, size_t N>
+    class IsArray<std::array<T, N>> : public std::true_type {};
+
+    template <class T>
+    class IsSpan : public std::false_type {};
+
+#ifdef __cpp_lib_span
+    template <class T, size_t Extent>
+    class IsSpan<std::span<T, Extent>> : public std::true_type {};
+#endif
+
+    /* Values written with a 'v', 'm' or 't' type header */
+    template <class T>
+    class IsComposite : public std::disjunction<IsTuple<T>, IsPair<T>, IsVector<T>, IsArray<T>, IsSpan<T>,
+                                                IsMap<T>, IsUnorderedMap<T>, IsFlatMap<T>> {};
+
     template <class... Args>
     inline void WriteTupleType(std::tuple<Args...>*) {
         WriteByte(TYPE_TUPLE);
         WriteMinimal(sizeof...(Args));
         (WriteType<Args>(), ...);
     }
-*/
+
+    template <class First, class Second>
+    inline void WriteTupleType(std::pair<First, Second>*) {
+        WriteTupleType(static_cast<std::tuple<First, Second>*>(nullptr));
+    }
+
     template <class T>
     inline void WriteValue(const T& value) {
         if constexpr (std::is_integral_v<T>) {
-            WriteBytes(&value);
+            if constexpr (sizeof(T) == 1) {
+                WriteBytes(&value);
+            } else if (IsVarint<T>()) {
+                /* Unsigned values keep their bits, as in fixed-width encoding */
+                WriteVarint(ZigZag(static_cast<std::make_signed_t<T>>(value)));
+            } else {
+                WriteBytes(&value);
+            }
         } else if constexpr (std::is_floating_point_v<T>) {
             WriteBytes(&value);
         } else if constexpr (std::is_base_of_v<Serializable, std::decay_t<T>>) {
+            FrameScope frame(this);
             value.WriteValue(this);
+            frame.Close();
+        } else if constexpr (IsReflected<std::decay_t<T>>::value) {
+            FrameScope frame(this);
+            ForEachField<std::decay_t<T>>([&](auto member) { Write(value.*member); });
+            frame.Close();
         } else {
-            static_assert(std::disjunction_v<std::is_integral<T>, std::is_floating_point<T>, std::is_base_of<Serializable, std::decay_t<T>>>);
+            static_assert(std::disjunction_v<std::is_integral<T>, std::is_floating_point<T>, std::is_base_of<Serializable, std::decay_t<T>>, IsReflected<std::decay_t<T>>>);
         }
     }
 
-    void HonestWriteString(const std::string& str) {
-        WriteMinimal(str.size());
-        WriteBytes(str.c_str(), str.size());
+    void HonestWriteString(std::string_view str) {
+        WriteSignedLength(str.size());
+        WriteBytes(str.data(), str.size());
     }
 
     inline void WriteValue(const char* str) {
-        WriteValue(std::string(str));
+        WriteValue(std::string_view(str));
     }
 
-    inline void WriteValue(std::string str) {
-        if (string_cache_size_ == 0) {
-            HonestWriteString(str);
-            ++string_counter_;
-            return;
-        }
+    template <class Alloc>
+    inline void WriteValue(const std::basic_string<char, std::char_traits<char>, Alloc>& str) {
+        WriteValue(std::string_view(str));
+    }
 
+    inline void WriteValue(std::string_view str) {
         LOG(str);
-        auto iter = last_occurence_.find(str);
-        if (iter != last_occurence_.end()) {
-            WriteMinimal(-iter->second - 1);
-            iter->second = string_counter_;
-        } else {
-            HonestWriteString(str);
-            iter = last_occurence_.emplace(std::move(str), string_counter_).first;
+        if (dictionary_) {
+            if (int64_t index = dictionary_->Find(str); index >= 0) {
+                OOSF_STATS(++stats_.stats.dictionary_hits;)
+                WriteSignedLength(-index - 1);
+                return;
+            }
+        }
+        if (!frames_.empty()) {
+            WriteFramedString(str);
+            return;
         }
+        if (string_cache_size_ > 0) {
+            int64_t previous = string_cache_.Update(str, string_counter_);
+            if (previous >= record_base_) {
+                OOSF_STATS(++stats_.stats.cache_hits;)
+                OOSF_STATS(stats_.stats.backref_distance += string_counter_ - previous;)
+                WriteSignedLength(-(previous - record_base_) - dictionary_size_ - 1);
+                ++string_counter_;
+                return;
+            }
+            OOSF_STATS(++stats_.stats.cache_misses;)
+        }
+        HonestWriteString(str);
         ++string_counter_;
-        LOG(string_counter_);
-
-        string_frame_.push(iter);
-        if (static_cast<int>(string_frame_.size()) > string_cache_size_) {
-            auto old_string = string_frame_.front();
-            string_frame_.pop();
-            if (old_string->second + string_cache_size_ < string_counter_) {
-                last_occurence_.erase(old_string);
+    }
+
+    /*
+     * Strings inside frames are numbered after the cached ones from the start of the innermost frame, so a
+     * reader that jumps over the frame misses no string it refers to later. They refer back to either.
+     */
+    void WriteFramedString(std::string_view str) {
+        if (string_cache_size_ > 0) {
+            FrameStrings& strings = frame_strings_[frames_.size() - 1];
+            int64_t base = frames_.back().strings;
+            OOSF_STATS(int64_t next = string_counter_ + (strings.counter - base);)
+            int64_t previous = strings.cache.Update(str, strings.counter++);
+            previous = previous >= base ? string_counter_ + (previous - base)
+                                        : string_cache_.Find(str, string_counter_);
+            if (previous >= record_base_) {
+                OOSF_STATS(++stats_.stats.cache_hits;)
+                OOSF_STATS(stats_.stats.backref_distance += next - previous;)
+                WriteSignedLength(-(previous - record_base_) - dictionary_size_ - 1);
+                return;
             }
+            OOSF_STATS(++stats_.stats.cache_misses;)
         }
+        HonestWriteString(str);
     }
 
+    template <class Iter>
+    class IsSinglePass : public std::is_same<typename std::iterator_traits<Iter>::iterator_category,
+                                             std::input_iterator_tag> {};
+
     template <class T, class U>
     class IsSameIntegral : public std::conjunction<std::is_integral<T>, std::is_integral<U>,
                                                    std::integral_constant<bool, (sizeof(T) == sizeof(U))>> {};
 
+    /*
+     * Arithmetic values are written as raw bytes, so contiguous runs of them can be copied as one block.
+     * bool is left out: std::vector<bool> packs its bits and has no data().
+     */
     template <class T>
-    inline void WriteValue(const std::vector<T>& vec) {
-        WriteAsVectorInternal(vec.begin(), vec.size());
+    class IsBulkCopyable : public std::conjunction<std::is_arithmetic<T>, std::negation<std::is_same<T, bool>>> {};
+
+    template <class Iter>
+    class IsContiguousIterator : public std::conjunction<
+            std::negation<std::is_same<typename std::iterator_traits<Iter>::value_type, bool>>,
+            std::disjunction<
+                std::is_pointer<Iter>,
+                std::is_same<Iter, typename std::vector<typename std::iterator_traits<Iter>::value_type>::iterator>,
+                std::is_same<Iter,
+                             typename std::vector<typename std::iterator_traits<Iter>::value_type>::const_iterator>>> {};
+
+    template <class T, class Alloc>
+    inline void WriteValue(const std::vector<T, Alloc>& vec) {
+        if constexpr (std::is_same_v<T, bool>) {
+            WriteAsVectorInternal(vec.begin(), vec.size());
+        } else {
+            WriteAsVectorInternal(vec.data(), vec.size());
+        }
     }
 
-    template <class K, class V>
-    inline void WriteValue(const std::map<K, V>& map) {
+    template <class K, class V, class... Args>
+    inline void WriteValue(const std::map<K, V, Args...>& map) {
+        WriteAsMapInternal(map.begin(), map.size());
+    }
+
+    template <class K, class V, class... Args>
+    inline void WriteValue(const std::unordered_map<K, V, Args...>& map) {
+        WriteAsMapInternal(map.begin(), map.size());
+    }
+
+    template <class K, class V, class... Args>
+    inline void WriteValue(const FlatMap<K, V, Args...>& map) {
         WriteAsMapInternal(map.begin(), map.size());
     }
 
+    template <class T, size_t N>
+    inline void WriteValue(const std::array<T, N>& array) {
+        WriteAsVectorInternal(array.data(), N);
+    }
+
+#ifdef __cpp_lib_span
+    template <class T, size_t Extent>
+    inline void WriteValue(const std::span<T, Extent>& span) {
+        WriteAsVectorInternal(span.data(), span.size());
+    }
+#endif
+
+    template <class... Args>
+    inline void WriteValue(const std::tuple<Args...>& tuple) {
+        std::apply([this](const auto&... elements) { (WriteValue(elements), ...); }, tuple);
+    }
+
+    template <class First, class Second>
+    inline void WriteValue(const std::pair<First, Second>& pair) {
+        WriteValue(pair.first);
+        WriteValue(pair.second);
+    }
+
     template <class Iter>
     void WriteAsVectorInternal(Iter iter, int64_t count) {
-        WriteMinimal(count);
+        WriteLength(count);
+        using ValueType = typename std::iterator_traits<Iter>::value_type;
+        if constexpr (IsContiguousIterator<Iter>::value && IsBulkCopyable<ValueType>::value) {
+            if (!IsVarint<ValueType>()) {
+                if (count > 0) {
+                    WriteBytes(&*iter, count);
+                }
+                return;
+            }
+        }
         while (count --> 0) {
-            WriteValue(*iter);
+            /* std::vector<bool> iterators yield proxies */
+            WriteValue(static_cast<const ValueType&>(*iter));
             ++iter;
         }
     }
 
     template <class Iter>
     void WriteAsMapInternal(Iter iter, int64_t count) {
-        WriteMinimal(count);
+        WriteLength(count);
         while (count --> 0) {
             WriteValue(iter->first);
             WriteValue(iter->second);
@@ -250,20 +1000,177 @@ if constexpr (std::is_same_v<type, T> ||                        \
         }
     }
 
+    /* `count` projections of consecutive entries; raw arithmetic values go straight into the sink buffer */
+    template <class Iter, class Project>
+    void WriteColumn(Iter iter, int64_t count, Project project) {
+        using T = std::decay_t<decltype(project(*iter))>;
+        if constexpr (IsBulkCopyable<T>::value) {
+            if (!IsVarint<T>()) {
+                while (count > 0) {
+                    int64_t step = std::min<int64_t>(count, kChunkSize);
+                    char* ptr = sink_->Reserve(step * sizeof(T));
+                    for (int64_t i = 0; i < step; ++i, ++iter, ptr += sizeof(T)) {
+                        std::memcpy(ptr, &project(*iter), sizeof(T));
+                    }
+                    sink_->Commit(ptr);
+                    count -= step;
+                }
+                return;
+            }
+        }
+        for (; count > 0; --count, ++iter) {
+            WriteValue(project(*iter));
+        }
+    }
+
     inline void WriteByte(char byte) {
-        out_->put(byte);
+        sink_->Put(byte);
     }
 
     template <class T>
-    inline void WriteBytes(const T* value, int count = 1) {
-        out_->write(reinterpret_cast<const char*>(value), sizeof(T) * count);
+    inline void WriteBytes(const T* value, size_t count = 1) {
+        sink_->Write(reinterpret_cast<const char*>(value), sizeof(T) * count);
     }
 
     std::ostream* out_;
+    std::unique_ptr<OutputSink> owned_sink_;
+    OutputSink* sink_;
     int string_counter_;
     int string_cache_size_;
-    std::unordered_map<std::string, int> last_occurence_;
-    std::queue<typename std::unordered_map<std::string, int>::iterator> string_frame_;
+    FormatVersion version_;
+    int flags_;
+    std::string compression_buffer_;
+    std::string column_buffer_;
+    StringCache string_cache_;
+    const StringDictionary* dictionary_ = nullptr;
+    /* Cache references start after the dictionary indices */
+    int64_t dictionary_size_ = 0;
+
+    std::unordered_map<std::type_index, RegisteredClass> registered_classes_;
+    int64_t next_class_id_ = 0;
+
+    std::vector<Frame> frames_;
+    std::vector<RegisteredClass*> frame_classes_;
+    /* By frame depth */
+    std::vector<FrameStrings> frame_strings_;
+
+    /* Strings are numbered from the start of the current record */
+    int64_t record_base_ = 0;
+    std::vector<uint64_t> record_offsets_;
+    bool closed_ = false;
+
+    OOSF_STATS(StatsRecorder stats_;)
+
+    template <class T>
+    friend class VectorWriter;
+
+    template <class K, class V>
+    friend class MapWriter;
+};
+
+/* Element sink of a chunked vector started with OutputDataStream::BeginVector */
+template <class T>
+class VectorWriter {
+public:
+    VectorWriter() = default;
+
+    VectorWriter(const VectorWriter&) = delete;
+    void operator=(const VectorWriter&) = delete;
+
+    ~VectorWriter() {
+        try {
+            Close();
+        } catch (const std::exception&) {
+        }
+    }
+
+    void Write(T value) {
+        chunk_.push_back(std::move(value));
+        if (chunk_.size() == chunk_size_) {
+            WriteChunk();
+        }
+    }
+
+    /* Writes the last chunk and the terminator; nothing else may be written to the stream before that */
+    void Close() {
+        if (!out_) {
+            return;
+        }
+        WriteChunk();
+        out_->WriteLength(0);
+        out_ = nullptr;
+    }
+
+private:
+    void Open(OutputDataStream* out, size_t chunk_size) {
+        out_ = out;
+        chunk_size_ = std::max<size_t>(chunk_size, 1);
+        chunk_.reserve(chunk_size_);
+    }
+
+    void WriteChunk() {
+        if (!chunk_.empty()) {
+            out_->WriteAsVectorInternal(chunk_.begin(), chunk_.size());
+            chunk_.clear();
+        }
+    }
+
+    OutputDataStream* out_ = nullptr;
+    size_t chunk_size_ = 0;
+    std::vector<T> chunk_;
+
+    friend class OutputDataStream;
+};
+
+/* Entry sink of a chunked map started with OutputDataStream::BeginMap */
+template <class K, class V>
+class MapWriter {
+public:
+    MapWriter() = default;
+
+    MapWriter(const MapWriter&) = delete;
+    void operator=(const MapWriter&) = delete;
+
+    ~MapWriter() {
+        try {
+            Close();
+        } catch (const std::exception&) {
+        }
+    }
+
+    void Write(K key, V value) {
+        chunk_.emplace_back(std::move(key), std::move(value));
+        if (chunk_.size() == chunk_size_) {
+            WriteChunk();
+        }
+    }
+
+    void Close() {
+        if (!out_) {
+            return;
+        }
+        WriteChunk();
+        out_->WriteLength(0);
+        out_ = nullptr;
+    }
+
+private:
+    void Open(OutputDataStream* out, size_t chunk_size) {
+        out_ = out;
+        chunk_size_ = std::max<size_t>(chunk_size, 1);
+        chunk_.reserve(chunk_size_);
+    }
+
+    void WriteChunk() {
+        if (!chunk_.empty()) {
+            out_->WriteAsMapInternal(chunk_.begin(), chunk_.size());
+            chunk_.clear();
+        }
+    }
+
+    OutputDataStream* out_ = nullptr;
+    size_t chunk_size_ = 0;
+    std::vector<std::pair<K, V>> chunk_;
 
-    std::unordered_map<std::type_index, std::string> registered_classes_;
+    friend class OutputDataStream;
 };
@@ -0,0 +1,469 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <vector>
+#include <deque>
+#include <ostream>
+#include <stdexcept>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unistd.h>
+
+/* Serialization writes into the sink buffer; bytes reach the destination when it fills up or on Flush() */
+class OutputSink {
+public:
+    static constexpr size_t kBufferSize = 1 << 16;
+
+    explicit OutputSink(size_t buffer_size = kBufferSize) : buffer_(buffer_size) {
+        begin_ = cur_ = buffer_.data();
+        end_ = begin_ + buffer_.size();
+    }
+
+    virtual ~OutputSink() = default;
+
+    OutputSink(const OutputSink&) = delete;
+    void operator=(const OutputSink&) = delete;
+
+    inline void Put(char byte) {
+        if (cur_ == end_) {
+            Overflow(1);
+        }
+        *cur_++ = byte;
+    }
+
+    inline void Write(const char* data, size_t size) {
+        if (static_cast<size_t>(end_ - cur_) >= size) {
+            std::memcpy(cur_, data, size);
+            cur_ += size;
+            return;
+        }
+        WriteSlow(data, size);
+    }
+
+    /* Returns room for at least `size` bytes; Commit() the bytes actually written */
+    inline char* Reserve(size_t size) {
+        if (static_cast<size_t>(end_ - cur_) < size) {
+            Overflow(size);
+        }
+        return cur_;
+    }
+
+    inline void Commit(char* end) {
+        cur_ = end;
+    }
+
+    /* Total number of bytes written through the sink */
+    uint64_t Position() const {
+        return drained_ + (cur_ - begin_);
+    }
+
+    /*
+     * Keeps the bytes written from here on in the buffer until the matching Release(), so Patch() can still
+     * change them. Holds nest; while one is active the buffer grows instead of being written out.
+     */
+    uint64_t Hold() {
+        uint64_t position = Position();
+        if (holds_++ == 0) {
+            held_ = position;
+        }
+        return position;
+    }
+
+    void Release() {
+        --holds_;
+    }
+
+    /* Overwrites bytes at an absolute position written after an active Hold() */
+    void Patch(uint64_t position, const void* data, size_t size) {
+        std::memcpy(begin_ + (position - drained_), data, size);
+    }
+
+    virtual void Flush() {
+        Drain();
+    }
+
+protected:
+    virtual void WriteOut(const char* data, size_t size) = 0;
+
+    virtual void Overflow(size_t size) {
+        Drain();
+        if (static_cast<size_t>(end_ - cur_) < size) {
+            /* Held bytes stay, so the buffer doubles to keep growing them linear */
+            size_t used = cur_ - begin_;
+            buffer_.resize(used > 0 ? std::max(used + size, 2 * buffer_.size()) : size);
+            begin_ = buffer_.data();
+            cur_ = begin_ + used;
+            end_ = begin_ + buffer_.size();
+        }
+    }
+
+    virtual void WriteSlow(const char* data, size_t size) {
+        Drain();
+        if (holds_ == 0 && size >= static_cast<size_t>(end_ - begin_)) {
+            WriteOut(data, size);
+            drained_ += size;
+        } else {
+            if (static_cast<size_t>(end_ - cur_) < size) {
+                Overflow(size);
+            }
+            std::memcpy(cur_, data, size);
+            cur_ += size;
+        }
+    }
+
+    /* Writes out the buffer up to the first held byte; held bytes move to the front */
+    void Drain() {
+        char* keep = holds_ > 0 ? begin_ + (held_ - drained_) : cur_;
+        if (keep > begin_) {
+            WriteOut(begin_, keep - begin_);
+            drained_ += keep - begin_;
+            std::memmove(begin_, keep, cur_ - keep);
+            cur_ -= keep - begin_;
+        }
+    }
+
+    std::vector<char> buffer_;
+    char* begin_;
+    char* cur_;
+    char* end_;
+    uint64_t drained_ = 0;
+    size_t holds_ = 0;
+    uint64_t held_ = 0;
+};
+
+class OstreamOutputSink : public OutputSink {
+public:
+    explicit OstreamOutputSink(std::ostream* out, size_t buffer_size = kBufferSize)
+        : OutputSink(buffer_size), out_(out) {
+    }
+
+    ~OstreamOutputSink() {
+        Drain();
+    }
+
+    void Flush() override {
+        Drain();
+        out_->flush();
+    }
+
+protected:
+    void WriteOut(const char* data, size_t size) override {
+        out_->write(data, size);
+    }
+
+private:
+    std::ostream* out_;
+};
+
+class FdOutputSink : public OutputSink {
+public:
+    explicit FdOutputSink(int fd, size_t buffer_size = kBufferSize) : OutputSink(buffer_size), fd_(fd) {
+    }
+
+protected:
+    void WriteOut(const char* data, size_t size) override {
+        while (size > 0) {
+            ssize_t bytes = ::write(fd_, data, size);
+            if (bytes < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                cur_ = begin_;
+                throw std::runtime_error("Write error");
+            }
+            data += bytes;
+            size -= bytes;
+        }
+    }
+
+private:
+    int fd_;
+};
+
+/* Keeps everything in one growable buffer, which is never drained */
+class MemoryOutputSink : public OutputSink {
+public:
+    explicit MemoryOutputSink(size_t initial_size = kBufferSize) : OutputSink(initial_size) {
+    }
+
+    const char* Data() const {
+        return begin_;
+    }
+
+    size_t Size() const {
+        return cur_ - begin_;
+    }
+
+    void Clear() {
+        cur_ = begin_;
+    }
+
+    void Flush() override {
+    }
+
+protected:
+    void WriteOut(const char*, size_t) override {
+    }
+
+    void Overflow(size_t size) override {
+        size_t used = cur_ - begin_;
+        size_t capacity = std::max<size_t>(buffer_.size(), 1);
+        while (capacity < used + size) {
+            capacity *= 2;
+        }
+        buffer_.resize(capacity);
+        begin_ = buffer_.data();
+        cur_ = begin_ + used;
+        end_ = begin_ + buffer_.size();
+    }
+
+    void WriteSlow(const char* data, size_t size) override {
+        Overflow(size);
+        std::memcpy(cur_, data, size);
+        cur_ += size;
+    }
+};
+
+/*
+ * Hands full buffers to a background thread that writes them to `target`, so serialization does not wait for
+ * the disk. Buffers are aligned and at most `queue_depth` of them wait to be written; beyond that the producer
+ * blocks. I/O errors are reported by the next buffer switch, Flush() or Close().
+ */
+class AsyncOutputSink : public OutputSink {
+public:
+    static constexpr size_t kAsyncBufferSize = 1 << 20;
+    static constexpr size_t kAlignment = 4096;
+
+    explicit AsyncOutputSink(OutputSink* target, size_t buffer_size = kAsyncBufferSize, size_t queue_depth = 2)
+        : OutputSink(0), target_(target) {
+        buffer_size = std::max<size_t>(buffer_size, kAlignment);
+        for (size_t i = 0; i < std::max<size_t>(queue_depth, 1) + 1; ++i) {
+            buffers_.emplace_back();
+            Allocate(&buffers_.back(), buffer_size);
+            free_.push_back(&buffers_.back());
+        }
+        Acquire(0);
+        thread_ = std::thread([this] { Run(); });
+    }
+
+    ~AsyncOutputSink() {
+        try {
+            Close();
+        } catch (const std::exception&) {
+        }
+    }
+
+    /* Waits until everything written so far, up to an active hold, has reached the target and flushes it */
+    void Flush() override {
+        if (holds_ > 0) {
+            Carry(0);
+        } else {
+            Submit();
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return queue_.empty() && !busy_; });
+        if (!error_) {
+            try {
+                target_->Flush();
+            } catch (...) {
+                error_ = std::current_exception();
+            }
+        }
+        ThrowIfFailed();
+    }
+
+    /* Flushes and stops the I/O thread; the sink cannot be written to afterwards */
+    void Close() {
+        if (!thread_.joinable()) {
+            return;
+        }
+        std::exception_ptr error;
+        try {
+            Flush();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        ready_.notify_one();
+        thread_.join();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+protected:
+    void WriteOut(const char*, size_t) override {
+    }
+
+    void Overflow(size_t size) override {
+        /* Close() leaves no buffer, so every write after it ends up here */
+        if (stop_) {
+            throw std::runtime_error("Write after Close");
+        }
+        if (holds_ > 0) {
+            Carry(size);
+            return;
+        }
+        Submit();
+        Acquire(size);
+    }
+
+    void WriteSlow(const char* data, size_t size) override {
+        while (size > 0) {
+            if (cur_ == end_) {
+                Overflow(1);
+            }
+            size_t step = std::min<size_t>(size, end_ - cur_);
+            std::memcpy(cur_, data, step);
+            cur_ += step;
+            data += step;
+            size -= step;
+        }
+    }
+
+private:
+    struct Buffer {
+        std::unique_ptr<char, decltype(&std::free)> data{nullptr, &std::free};
+        size_t capacity = 0;
+        size_t size = 0;
+    };
+
+    static void Allocate(Buffer* buffer, size_t size) {
+        size = (size + kAlignment - 1) / kAlignment * kAlignment;
+        buffer->data.reset(static_cast<char*>(std::aligned_alloc(kAlignment, size)));
+        if (!buffer->data) {
+            throw std::bad_alloc();
+        }
+        buffer->capacity = size;
+    }
+
+    /* Queues the current buffer for writing */
+    void Submit() {
+        if (!current_ || cur_ == begin_) {
+            return;
+        }
+        current_->size = cur_ - begin_;
+        drained_ += current_->size;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(current_);
+        }
+        ready_.notify_one();
+        current_ = nullptr;
+        begin_ = cur_ = end_ = nullptr;
+    }
+
+    /* Queues the buffer up to the first held byte and moves the held bytes to a buffer with room for `size` more */
+    void Carry(size_t size) {
+        if (stop_) {
+            throw std::runtime_error("Write after Close");
+        }
+        Buffer* previous = current_;
+        char* keep = begin_ + (held_ - drained_);
+        size_t ready = keep - begin_;
+        size_t kept = cur_ - keep;
+        current_ = nullptr;
+        Acquire(kept + std::max(size, kept));
+        if (!previous) {
+            return;
+        }
+        std::memcpy(begin_, keep, kept);
+        cur_ = begin_ + kept;
+        drained_ += ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (ready > 0) {
+                previous->size = ready;
+                queue_.push_back(previous);
+            } else {
+                free_.push_back(previous);
+            }
+        }
+        ready_.notify_one();
+        done_.notify_all();
+    }
+
+    /* Takes a free buffer of at least `size` bytes, waiting for the I/O thread if there is none */
+    void Acquire(size_t size) {
+        if (current_) {
+            if (current_->capacity >= size) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_.push_back(current_);
+            current_ = nullptr;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return !free_.empty(); });
+        ThrowIfFailed();
+        current_ = free_.front();
+        free_.pop_front();
+        lock.unlock();
+        if (current_->capacity < size) {
+            Allocate(current_, size);
+        }
+        begin_ = cur_ = current_->data.get();
+        end_ = begin_ + current_->capacity;
+    }
+
+    void ThrowIfFailed() {
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            ready_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;
+            }
+            Buffer* buffer = queue_.front();
+            queue_.pop_front();
+            busy_ = true;
+            bool failed = error_ != nullptr;
+            lock.unlock();
+            std::exception_ptr error;
+            if (!failed) {
+                try {
+                    target_->Write(buffer->data.get(), buffer->size);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            lock.lock();
+            if (error && !error_) {
+                error_ = error;
+            }
+            busy_ = false;
+            free_.push_back(buffer);
+            done_.notify_all();
+        }
+    }
+
+    OutputSink* target_;
+    std::deque<Buffer> buffers_;
+    Buffer* current_ = nullptr;
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::condition_variable done_;
+    std::deque<Buffer*> free_;
+    std::deque<Buffer*> queue_;
+    bool busy_ = false;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    std::thread thread_;
+};
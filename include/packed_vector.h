@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Integer vectors are packed in blocks of kBlockSize values. A block is a header byte (bit 7 selects delta
+ * coding, bits 0-6 hold the bit width w), an 8-byte reference value and 4 * w 64-bit words. Value i goes to
+ * lane i % 4 and the four lanes are interleaved word by word, so one vector load unpacks four consecutive
+ * values. Frame-of-reference blocks store v - reference; delta blocks store v[i] - v[i - 1] - reference.
+ */
+class PackedVectorCodec {
+public:
+    static constexpr int kBlockSize = 256;
+    static constexpr int kLanes = 4;
+    static constexpr int kLaneSize = kBlockSize / kLanes;
+    static constexpr size_t kMaxBlockBytes = 9 + kLanes * 64 * 8;
+
+    static size_t BlockBytes(unsigned char header) {
+        return 9 + kLanes * 8 * (header & 0x7f);
+    }
+
+    /* Writes one full block to `out` (at least kMaxBlockBytes long) and returns its size */
+    static size_t EncodeBlock(const int64_t* values, int64_t previous, char* out) {
+        uint64_t deltas[kBlockSize];
+        for (int i = 0; i < kBlockSize; ++i) {
+            deltas[i] = static_cast<uint64_t>(values[i]) - static_cast<uint64_t>(previous);
+            previous = values[i];
+        }
+
+        int64_t min_value = 0;
+        int width = Width(reinterpret_cast<const uint64_t*>(values), &min_value);
+        int64_t min_delta = 0;
+        int delta_width = Width(deltas, &min_delta);
+
+        bool delta = delta_width < width;
+        uint64_t reference = delta ? min_delta : min_value;
+        const uint64_t* source = delta ? deltas : reinterpret_cast<const uint64_t*>(values);
+        if (delta) {
+            width = delta_width;
+        }
+
+        out[0] = static_cast<char>((delta ? 0x80 : 0) | width);
+        std::memcpy(out + 1, &reference, 8);
+        char* words = out + 9;
+        std::memset(words, 0, kLanes * 8 * width);
+        for (int lane = 0; lane < kLanes; ++lane) {
+            for (int j = 0; j < kLaneSize; ++j) {
+                uint64_t value = source[j * kLanes + lane] - reference;
+                int bit = j * width;
+                OrWord(words, bit / 64, lane, value << (bit % 64));
+                if (bit % 64 + width > 64) {
+                    OrWord(words, bit / 64 + 1, lane, value >> (64 - bit % 64));
+                }
+            }
+        }
+        return BlockBytes(out[0]);
+    }
+
+    /* Decodes the block at `in` into kBlockSize values at `out` */
+    static void DecodeBlock(const char* in, int64_t previous, int64_t* out) {
+        unsigned char header = in[0];
+        int width = header & 0x7f;
+        bool delta = header & 0x80;
+        uint64_t reference;
+        std::memcpy(&reference, in + 1, 8);
+        const char* words = in + 9;
+
+        if (width == 0) {
+            DecodeScalar(words, width, delta, reference, previous, out);
+            return;
+        }
+#if defined(__AVX2__)
+        DecodeAvx2(words, width, delta, reference, previous, out);
+#elif defined(__SSE2__)
+        DecodeSse2(words, width, delta, reference, previous, out);
+#else
+        DecodeScalar(words, width, delta, reference, previous, out);
+#endif
+    }
+
+    static void DecodeScalar(const char* words, int width, bool delta, uint64_t reference,
+                             int64_t previous, int64_t* out) {
+        uint64_t mask = width == 64 ? ~0ULL : (1ULL << width) - 1;
+        uint64_t last = previous;
+        for (int j = 0; j < kLaneSize; ++j) {
+            int bit = j * width;
+            for (int lane = 0; lane < kLanes; ++lane) {
+                uint64_t value = width == 0 ? 0 : LoadWord(words, bit / 64, lane) >> (bit % 64);
+                if (bit % 64 + width > 64) {
+                    value |= LoadWord(words, bit / 64 + 1, lane) << (64 - bit % 64);
+                }
+                value = (value & mask) + reference;
+                if (delta) {
+                    value += last;
+                    last = value;
+                }
+                out[j * kLanes + lane] = value;
+            }
+        }
+    }
+
+private:
+    static int Width(const uint64_t* values, int64_t* min_value) {
+        int64_t min = values[0];
+        int64_t max = values[0];
+        for (int i = 1; i < kBlockSize; ++i) {
+            int64_t value = values[i];
+            min = value < min ? value : min;
+            max = value > max ? value : max;
+        }
+        *min_value = min;
+        uint64_t range = static_cast<uint64_t>(max) - static_cast<uint64_t>(min);
+        return range == 0 ? 0 : 64 - __builtin_clzll(range);
+    }
+
+    static inline uint64_t LoadWord(const char* words, int index, int lane) {
+        uint64_t word;
+        std::memcpy(&word, words + (index * kLanes + lane) * 8, 8);
+        return word;
+    }
+
+    static inline void OrWord(char* words, int index, int lane, uint64_t bits) {
+        uint64_t word = LoadWord(words, index, lane) | bits;
+        std::memcpy(words + (index * kLanes + lane) * 8, &word, 8);
+    }
+
+#if defined(__AVX2__)
+    static void DecodeAvx2(const char* words, int width, bool delta, uint64_t reference,
+                           int64_t previous, int64_t* out) {
+        const __m256i mask = _mm256_set1_epi64x(width == 64 ? ~0ULL : (1ULL << width) - 1);
+        const __m256i base = _mm256_set1_epi64x(reference);
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i carry = _mm256_set1_epi64x(previous);
+        for (int j = 0; j < kLaneSize; ++j) {
+            int bit = j * width;
+            const char* ptr = words + (bit / 64) * kLanes * 8;
+            __m256i value = _mm256_srl_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr)),
+                                             _mm_cvtsi32_si128(bit % 64));
+            if (bit % 64 + width > 64) {
+                __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + kLanes * 8));
+                value = _mm256_or_si256(value, _mm256_sll_epi64(next, _mm_cvtsi32_si128(64 - bit % 64)));
+            }
+            value = _mm256_add_epi64(_mm256_and_si256(value, mask), base);
+            if (delta) {
+                /* Prefix sum of [a, b, c, d] plus the last value of the previous group */
+                __m256i shifted = _mm256_blend_epi32(_mm256_permute4x64_epi64(value, 0x90), zero, 0x03);
+                value = _mm256_add_epi64(value, shifted);
+                shifted = _mm256_blend_epi32(_mm256_permute4x64_epi64(value, 0x40), zero, 0x0F);
+                value = _mm256_add_epi64(_mm256_add_epi64(value, shifted), carry);
+                carry = _mm256_permute4x64_epi64(value, 0xFF);
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j * kLanes), value);
+        }
+    }
+#elif defined(__SSE2__)
+    static void DecodeSse2(const char* words, int width, bool delta, uint64_t reference,
+                           int64_t previous, int64_t* out) {
+        const __m128i mask = _mm_set1_epi64x(width == 64 ? ~0ULL : (1ULL << width) - 1);
+        const __m128i base = _mm_set1_epi64x(reference);
+        __m128i carry = _mm_set1_epi64x(previous);
+        for (int j = 0; j < kLaneSize; ++j) {
+            int bit = j * width;
+            const char* ptr = words + (bit / 64) * kLanes * 8;
+            __m128i shift = _mm_cvtsi32_si128(bit % 64);
+            __m128i low = _mm_srl_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)), shift);
+            __m128i high = _mm_srl_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + 16)), shift);
+            if (bit % 64 + width > 64) {
+                __m128i back = _mm_cvtsi32_si128(64 - bit % 64);
+                const char* next = ptr + kLanes * 8;
+                low = _mm_or_si128(low, _mm_sll_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(next)), back));
+                high = _mm_or_si128(high, _mm_sll_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(next + 16)), back));
+            }
+            low = _mm_add_epi64(_mm_and_si128(low, mask), base);
+            high = _mm_add_epi64(_mm_and_si128(high, mask), base);
+            if (delta) {
+                low = _mm_add_epi64(_mm_add_epi64(low, _mm_slli_si128(low, 8)), carry);
+                carry = _mm_unpackhi_epi64(low, low);
+                high = _mm_add_epi64(_mm_add_epi64(high, _mm_slli_si128(high, 8)), carry);
+                carry = _mm_unpackhi_epi64(high, high);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j * kLanes), low);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j * kLanes + 2), high);
+        }
+    }
+#endif
+};
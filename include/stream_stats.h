@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Counters behind OutputDataStream::GetStats() and InputDataStream::GetStats(). They are only collected,
+ * and GetStats() only exists, when built with OOSF_ENABLE_STATS; otherwise the counting code is compiled out.
+ */
+#ifdef OOSF_ENABLE_STATS
+#define OOSF_STATS(x) x
+#else
+#define OOSF_STATS(x)
+#endif
+
+struct StreamStats {
+    /*
+     * Values written or read through Write() / TryRead(), by the first byte of the value. The bytes of values
+     * nested in a struct go to their own tags, so every byte is counted once.
+     */
+    std::array<uint64_t, 256> tag_count{};
+    std::array<uint64_t, 256> tag_bytes{};
+
+    uint64_t cache_hits = 0;
+    uint64_t cache_misses = 0;
+    uint64_t cache_evictions = 0;
+    /* Strings found in the StringDictionary of the stream; they count neither as hits nor as misses */
+    uint64_t dictionary_hits = 0;
+    /* Sum of (current string number - referenced string number) over all hits */
+    uint64_t backref_distance = 0;
+
+    /* Reader only: rewinds after failed type checks and jumps to another offset of the source */
+    uint64_t rewinds = 0;
+    uint64_t seeks = 0;
+
+    /* Heap allocations made by the stream: decoded strings and containers, cache and codec buffers */
+    uint64_t allocations = 0;
+
+    double AverageBackrefDistance() const {
+        return cache_hits > 0 ? static_cast<double>(backref_distance) / cache_hits : 0;
+    }
+
+    void Merge(const StreamStats& other) {
+        for (size_t i = 0; i < tag_count.size(); ++i) {
+            tag_count[i] += other.tag_count[i];
+            tag_bytes[i] += other.tag_bytes[i];
+        }
+        cache_hits += other.cache_hits;
+        cache_misses += other.cache_misses;
+        cache_evictions += other.cache_evictions;
+        dictionary_hits += other.dictionary_hits;
+        backref_distance += other.backref_distance;
+        rewinds += other.rewinds;
+        seeks += other.seeks;
+        allocations += other.allocations;
+    }
+};
+
+/* Attributes stream bytes to the innermost open value; a value that consumed no bytes is not counted */
+class StatsRecorder {
+public:
+    void Enter(int tag, uint64_t position) {
+        Account(position);
+        open_.push_back({static_cast<uint8_t>(tag), position});
+    }
+
+    void Leave(uint64_t position) {
+        Account(position);
+        if (position > open_.back().start) {
+            ++stats.tag_count[open_.back().tag];
+        }
+        open_.pop_back();
+    }
+
+    StreamStats stats;
+
+private:
+    struct OpenValue {
+        uint8_t tag;
+        uint64_t start;
+    };
+
+    /* A rewind moves the position back, which adds nothing */
+    void Account(uint64_t position) {
+        if (!open_.empty() && position > mark_) {
+            stats.tag_bytes[open_.back().tag] += position - mark_;
+        }
+        mark_ = position;
+    }
+
+    std::vector<OpenValue> open_;
+    uint64_t mark_ = 0;
+};
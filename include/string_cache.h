@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "stream_stats.h"
+
+/*
+ * Writer-side string cache: remembers the last occurrence of every string among the last `capacity` strings.
+ * Strings live in reusable slots, the index is an open-addressing table keyed by a hash computed once per
+ * string, and a ring of capacity + 1 occurrences tells which slot falls out of the window next. Hits never
+ * allocate; misses only allocate when a slot has to grow.
+ */
+class StringCache {
+public:
+    explicit StringCache(int capacity) : capacity_(capacity) {
+        if (capacity_ <= 0) {
+            return;
+        }
+        size_t table_size = 1;
+        while (table_size < 2 * static_cast<size_t>(capacity_ + 1)) {
+            table_size *= 2;
+        }
+        table_.assign(table_size, -1);
+        mask_ = table_size - 1;
+        slots_.resize(capacity_ + 1);
+        ring_.assign(capacity_ + 1, -1);
+        free_.reserve(capacity_ + 1);
+        for (int i = capacity_; i >= 0; --i) {
+            free_.push_back(i);
+        }
+    }
+
+    /* Records `str` as string number `counter`; returns the number of its previous occurrence in the window or -1 */
+    int64_t Update(std::string_view str, int64_t counter) {
+        size_t ring_index = counter % (capacity_ + 1);
+        if (int32_t expired = ring_[ring_index]; expired >= 0 && slots_[expired].last + capacity_ < counter) {
+            Erase(expired);
+        }
+
+        uint64_t hash = std::hash<std::string_view>()(str);
+        size_t pos = hash & mask_;
+        for (; table_[pos] >= 0; pos = (pos + 1) & mask_) {
+            Slot& slot = slots_[table_[pos]];
+            if (slot.hash == hash && slot.text == str) {
+                int64_t previous = slot.last;
+                slot.last = counter;
+                ring_[ring_index] = table_[pos];
+                return previous;
+            }
+        }
+
+        int32_t index = free_.back();
+        free_.pop_back();
+        Slot& slot = slots_[index];
+        OOSF_STATS(allocations_ += str.size() > slot.text.capacity());
+        slot.text.assign(str.data(), str.size());
+        slot.hash = hash;
+        slot.last = counter;
+        table_[pos] = index;
+        ring_[ring_index] = index;
+        return -1;
+    }
+
+    /* Number of the last occurrence of `str` if string number `counter` may still refer to it, otherwise -1 */
+    int64_t Find(std::string_view str, int64_t counter) const {
+        if (capacity_ <= 0) {
+            return -1;
+        }
+        uint64_t hash = std::hash<std::string_view>()(str);
+        for (size_t pos = hash & mask_; table_[pos] >= 0; pos = (pos + 1) & mask_) {
+            const Slot& slot = slots_[table_[pos]];
+            if (slot.hash == hash && slot.text == str) {
+                return slot.last + capacity_ >= counter ? slot.last : -1;
+            }
+        }
+        return -1;
+    }
+
+#ifdef OOSF_ENABLE_STATS
+    uint64_t Evictions() const {
+        return evictions_;
+    }
+
+    uint64_t Allocations() const {
+        return allocations_;
+    }
+#endif
+
+private:
+    struct Slot {
+        std::string text;
+        uint64_t hash = 0;
+        int64_t last = -1;
+    };
+
+    /* Linear probing deletion with backward shift, so lookups never need tombstones */
+    void Erase(int32_t index) {
+        size_t pos = slots_[index].hash & mask_;
+        while (table_[pos] != index) {
+            pos = (pos + 1) & mask_;
+        }
+        size_t next = pos;
+        while (true) {
+            next = (next + 1) & mask_;
+            if (table_[next] < 0) {
+                break;
+            }
+            size_t home = slots_[table_[next]].hash & mask_;
+            if (((next - home) & mask_) >= ((next - pos) & mask_)) {
+                table_[pos] = table_[next];
+                pos = next;
+            }
+        }
+        table_[pos] = -1;
+        free_.push_back(index);
+        OOSF_STATS(++evictions_);
+    }
+
+    int capacity_;
+    size_t mask_ = 0;
+    std::vector<int32_t> table_;
+    std::vector<Slot> slots_;
+    std::vector<int32_t> ring_;
+    std::vector<int32_t> free_;
+    OOSF_STATS(uint64_t evictions_ = 0;)
+    OOSF_STATS(uint64_t allocations_ = 0;)
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * Strings both sides know before a stream starts, such as the keys and enum names of a message schema. A string
+ * found here is written as its index, which costs the same however long ago it was last seen and takes no place
+ * in the string cache. Streams name a shared dictionary by its size and Fingerprint(), so a reader given a
+ * different one refuses the stream; alternatively the writer embeds the entries in the stream header.
+ */
+class StringDictionary {
+public:
+    StringDictionary() = default;
+
+    /* Of equal entries the first one is found */
+    explicit StringDictionary(std::vector<std::string> entries) : entries_(std::move(entries)) {
+        size_t table_size = 1;
+        while (table_size < 2 * entries_.size()) {
+            table_size *= 2;
+        }
+        table_.assign(table_size, -1);
+        hashes_.resize(entries_.size());
+        mask_ = table_size - 1;
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            hashes_[i] = std::hash<std::string_view>()(entries_[i]);
+            size_t pos = hashes_[i] & mask_;
+            while (table_[pos] >= 0 && entries_[table_[pos]] != entries_[i]) {
+                pos = (pos + 1) & mask_;
+            }
+            if (table_[pos] < 0) {
+                table_[pos] = i;
+            }
+        }
+    }
+
+    /*
+     * The `max_entries` strings seen most often among [begin, end), each at least `min_count` times. The most
+     * frequent ones come first, so they get the shortest indices. The samples are copied as they are counted,
+     * so iterators that yield temporaries or reuse their storage, like std::istream_iterator, work as well.
+     */
+    template <class Iter>
+    static StringDictionary FromSamples(Iter begin, Iter end, size_t max_entries, size_t min_count = 2) {
+        std::unordered_map<std::string, size_t> counts;
+        for (; begin != end; ++begin) {
+            ++counts[std::string(std::string_view(*begin))];
+        }
+        std::vector<std::pair<std::string_view, size_t>> frequent;
+        for (const auto& entry : counts) {
+            if (entry.second >= min_count) {
+                frequent.push_back(entry);
+            }
+        }
+        std::sort(frequent.begin(), frequent.end(), [](const auto& left, const auto& right) {
+            return left.second != right.second ? left.second > right.second : left.first < right.first;
+        });
+        frequent.resize(std::min(frequent.size(), max_entries));
+        std::vector<std::string> entries;
+        entries.reserve(frequent.size());
+        for (const auto& entry : frequent) {
+            entries.emplace_back(entry.first);
+        }
+        return StringDictionary(std::move(entries));
+    }
+
+    size_t Size() const {
+        return entries_.size();
+    }
+
+    std::string_view At(size_t index) const {
+        return entries_[index];
+    }
+
+    const std::vector<std::string>& Entries() const {
+        return entries_;
+    }
+
+    /* Index of `str`, or -1 */
+    int64_t Find(std::string_view str) const {
+        if (entries_.empty()) {
+            return -1;
+        }
+        uint64_t hash = std::hash<std::string_view>()(str);
+        for (size_t pos = hash & mask_; table_[pos] >= 0; pos = (pos + 1) & mask_) {
+            int32_t index = table_[pos];
+            if (hashes_[index] == hash && entries_[index] == str) {
+                return index;
+            }
+        }
+        return -1;
+    }
+
+    /* FNV-1a over the 8-byte lengths and the bytes of the entries; unlike std::hash the same everywhere */
+    uint64_t Fingerprint() const {
+        return fingerprint_;
+    }
+
+private:
+    uint64_t ComputeFingerprint() const {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](unsigned char byte) {
+            hash = (hash ^ byte) * 1099511628211ull;
+        };
+        for (const std::string& entry : entries_) {
+            for (int shift = 0; shift < 64; shift += 8) {
+                mix(static_cast<uint64_t>(entry.size()) >> shift & 0xff);
+            }
+            for (char ch : entry) {
+                mix(ch);
+            }
+        }
+        return hash;
+    }
+
+    std::vector<std::string> entries_;
+    std::vector<uint64_t> hashes_;
+    std::vector<int32_t> table_;
+    size_t mask_ = 0;
+    /* Initialized after entries_ */
+    uint64_t fingerprint_ = ComputeFingerprint();
+};
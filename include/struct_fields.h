@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "types.h"
+
+/*
+ * Field list of a struct, for encodings that look inside it such as OutputDataStream::WriteAsColumnarVector:
+ *
+ *     template <>
+ *     struct StructFields<Trade> {
+ *         static constexpr auto kFields = std::make_tuple(&Trade::price, &Trade::quantity, &Trade::symbol);
+ *     };
+ *
+ * or, at global scope, OOSF_REFLECT(Trade, price, quantity, symbol), which also names the class "Trade".
+ */
+template <class T>
+struct StructFields {};
+
+template <class T, class Enable = void>
+struct HasStructFields : std::false_type {};
+
+template <class T>
+struct HasStructFields<T, std::void_t<decltype(StructFields<T>::kFields)>> : std::true_type {};
+
+/*
+ * Described types that do not derive from Serializable are encoded without virtual calls: field by field,
+ * exactly as a Serializable whose WriteValue() writes the same fields in order, so the two are interchangeable.
+ */
+template <class T>
+struct IsReflected : std::conjunction<HasStructFields<T>, std::negation<std::is_base_of<Serializable, T>>> {};
+
+template <class T>
+using FieldList = std::decay_t<decltype(StructFields<T>::kFields)>;
+
+template <class T>
+constexpr size_t kFieldCount = std::tuple_size_v<FieldList<T>>;
+
+template <class Member>
+struct MemberType;
+
+template <class M, class T>
+struct MemberType<M T::*> {
+    using type = M;
+};
+
+/* Calls f(member pointer) for every field, in declaration order */
+template <class T, class F>
+void ForEachField(F&& f) {
+    std::apply([&f](auto... members) { (f(members), ...); }, StructFields<T>::kFields);
+}
+
+/* Columns of a columnar vector of T, one std::vector per field; bool fields come as bytes */
+template <class T>
+class StructColumns {
+    template <class M>
+    using ColumnType = std::vector<std::conditional_t<std::is_same_v<M, bool>, int8_t, M>>;
+
+    template <class Fields>
+    struct ColumnsOf;
+
+    template <class... Members>
+    struct ColumnsOf<std::tuple<Members...>> {
+        using type = std::tuple<ColumnType<typename MemberType<Members>::type>...>;
+    };
+
+public:
+    using Columns = typename ColumnsOf<FieldList<T>>::type;
+
+    size_t Size() const {
+        return std::get<0>(columns_).size();
+    }
+
+    template <size_t I>
+    const auto& Column() const {
+        return std::get<I>(columns_);
+    }
+
+    template <size_t I>
+    auto& Column() {
+        return std::get<I>(columns_);
+    }
+
+    Columns& AllColumns() {
+        return columns_;
+    }
+
+private:
+    Columns columns_;
+};
+
+#define OOSF_EXPAND(x) x
+#define OOSF_FIELD_POINTER(Type, field) &Type::field
+#define OOSF_FOR_EACH_1(m, Type, x) m(Type, x)
+#define OOSF_FOR_EACH_2(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_1(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_3(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_2(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_4(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_3(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_5(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_4(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_6(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_5(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_7(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_6(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_8(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_7(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_9(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_8(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_10(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_9(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_11(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_10(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_12(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_11(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_13(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_12(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_14(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_13(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_15(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_14(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_16(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_15(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_17(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_16(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_18(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_17(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_19(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_18(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_20(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_19(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_21(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_20(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_22(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_21(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_23(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_22(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_24(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_23(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_25(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_24(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_26(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_25(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_27(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_26(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_28(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_27(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_29(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_28(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_30(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_29(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_31(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_30(m, Type, __VA_ARGS__))
+#define OOSF_FOR_EACH_32(m, Type, x, ...) m(Type, x), OOSF_EXPAND(OOSF_FOR_EACH_31(m, Type, __VA_ARGS__))
+#define OOSF_SELECT_FOR_EACH(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, NAME, ...) NAME
+#define OOSF_FOR_EACH(m, Type, ...) \
+    OOSF_EXPAND(OOSF_SELECT_FOR_EACH(__VA_ARGS__, \
+        OOSF_FOR_EACH_32, OOSF_FOR_EACH_31, OOSF_FOR_EACH_30, OOSF_FOR_EACH_29, \
+        OOSF_FOR_EACH_28, OOSF_FOR_EACH_27, OOSF_FOR_EACH_26, OOSF_FOR_EACH_25, \
+        OOSF_FOR_EACH_24, OOSF_FOR_EACH_23, OOSF_FOR_EACH_22, OOSF_FOR_EACH_21, \
+        OOSF_FOR_EACH_20, OOSF_FOR_EACH_19, OOSF_FOR_EACH_18, OOSF_FOR_EACH_17, \
+        OOSF_FOR_EACH_16, OOSF_FOR_EACH_15, OOSF_FOR_EACH_14, OOSF_FOR_EACH_13, \
+        OOSF_FOR_EACH_12, OOSF_FOR_EACH_11, OOSF_FOR_EACH_10, OOSF_FOR_EACH_9, \
+        OOSF_FOR_EACH_8, OOSF_FOR_EACH_7, OOSF_FOR_EACH_6, OOSF_FOR_EACH_5, \
+        OOSF_FOR_EACH_4, OOSF_FOR_EACH_3, OOSF_FOR_EACH_2, OOSF_FOR_EACH_1)(m, Type, __VA_ARGS__))
+
+#define OOSF_REFLECT(Type, ...)                                                                      \
+    template <>                                                                                      \
+    struct StructFields<Type> {                                                                      \
+        static constexpr const char* kName = #Type;                                                  \
+        static constexpr auto kFields = std::make_tuple(OOSF_FOR_EACH(OOSF_FIELD_POINTER, Type, __VA_ARGS__)); \
+    };
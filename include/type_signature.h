@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#if __has_include(<span>)
+#include <span>
+#endif
+#include "types.h"
+#include "flat_map.h"
+
+/* Type headers of types without registered classes are known at compile time and are written and checked whole */
+template <char... Tags>
+struct CharList {
+    static constexpr char value[] = {Tags...};
+    static constexpr size_t size = sizeof...(Tags);
+};
+
+template <class... Lists>
+struct ConcatChars;
+
+template <char... Tags>
+struct ConcatChars<CharList<Tags...>> {
+    using type = CharList<Tags...>;
+};
+
+template <char... First, char... Second, class... Rest>
+struct ConcatChars<CharList<First...>, CharList<Second...>, Rest...>
+    : ConcatChars<CharList<First..., Second...>, Rest...> {};
+
+struct NoSignature {
+    static constexpr bool kSupported = false;
+};
+
+template <char... Tags>
+struct SimpleSignature {
+    static constexpr bool kSupported = true;
+    using type = CharList<Tags...>;
+};
+
+template <class T, class Enable = void>
+struct TypeSignature : NoSignature {};
+
+template <bool Supported, class Prefix, class... Inner>
+struct CompositeSignatureImpl : NoSignature {};
+
+template <class Prefix, class... Inner>
+struct CompositeSignatureImpl<true, Prefix, Inner...> {
+    static constexpr bool kSupported = true;
+    using type = typename ConcatChars<Prefix, typename TypeSignature<Inner>::type...>::type;
+};
+
+template <char Tag, class... Inner>
+using CompositeSignature =
+    CompositeSignatureImpl<(TypeSignature<Inner>::kSupported && ...), CharList<Tag>, Inner...>;
+
+/* Tuples carry their arity the way WriteMinimal writes small numbers: an int8 tag and one byte */
+template <class... Inner>
+using TupleSignature =
+    CompositeSignatureImpl<(TypeSignature<Inner>::kSupported && ...) && sizeof...(Inner) < 128,
+                           CharList<TYPE_TUPLE, TYPE_INT8, static_cast<char>(sizeof...(Inner))>, Inner...>;
+
+/* Integers are tagged by size, the same way OutputDataStream::WriteType does it */
+template <size_t Size>
+struct IntegerSignature : NoSignature {};
+
+template <> struct IntegerSignature<1> : SimpleSignature<TYPE_INT8> {};
+template <> struct IntegerSignature<2> : SimpleSignature<TYPE_INT16> {};
+template <> struct IntegerSignature<4> : SimpleSignature<TYPE_INT32> {};
+template <> struct IntegerSignature<8> : SimpleSignature<TYPE_INT64> {};
+
+template <class T>
+struct TypeSignature<T, std::enable_if_t<std::is_integral_v<T>>> : IntegerSignature<sizeof(T)> {};
+
+template <> struct TypeSignature<float> : SimpleSignature<TYPE_FLOAT> {};
+template <> struct TypeSignature<double> : SimpleSignature<TYPE_DOUBLE> {};
+template <class Alloc>
+struct TypeSignature<std::basic_string<char, std::char_traits<char>, Alloc>> : SimpleSignature<TYPE_STRING> {};
+template <> struct TypeSignature<char*> : SimpleSignature<TYPE_STRING> {};
+template <> struct TypeSignature<const char*> : SimpleSignature<TYPE_STRING> {};
+template <> struct TypeSignature<std::shared_ptr<const char[]>> : SimpleSignature<TYPE_STRING> {};
+
+template <class T, class Alloc>
+struct TypeSignature<std::vector<T, Alloc>> : CompositeSignature<TYPE_VECTOR, T> {};
+
+template <class K, class V, class... Args>
+struct TypeSignature<std::map<K, V, Args...>> : CompositeSignature<TYPE_MAP, K, V> {};
+
+template <class K, class V, class... Args>
+struct TypeSignature<std::unordered_map<K, V, Args...>> : CompositeSignature<TYPE_MAP, K, V> {};
+
+template <class K, class V, class... Args>
+struct TypeSignature<FlatMap<K, V, Args...>> : CompositeSignature<TYPE_MAP, K, V> {};
+
+template <class T, size_t N>
+struct TypeSignature<std::array<T, N>> : CompositeSignature<TYPE_VECTOR, T> {};
+
+#ifdef __cpp_lib_span
+template <class T, size_t Extent>
+struct TypeSignature<std::span<T, Extent>> : CompositeSignature<TYPE_VECTOR, std::remove_cv_t<T>> {};
+#endif
+
+template <class... Args>
+struct TypeSignature<std::tuple<Args...>> : TupleSignature<Args...> {};
+
+template <class First, class Second>
+struct TypeSignature<std::pair<First, Second>> : TupleSignature<First, Second> {};
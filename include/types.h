@@ -9,14 +9,55 @@
 #define TYPE_STRING 's'
 #define TYPE_VECTOR 'v'
 #define TYPE_MAP    'm'
-// #define TYPE_TUPLE  't'
+#define TYPE_TUPLE  't'
 #define TYPE_BOOL   '?'
 #define TYPE_BOOL_T '+'
 #define TYPE_BOOL_F '-'
 #define TYPE_STRUCT '!'
+#define TYPE_PACKED_VECTOR 'p'
+#define TYPE_XOR_VECTOR 'x'
+#define TYPE_CHUNKED_VECTOR 'V'
+#define TYPE_CHUNKED_MAP 'M'
+#define TYPE_COLUMNAR_MAP 'c'
+#define TYPE_COLUMNAR_VECTOR 'C'
+#define TYPE_RECORD '@'
+#define TYPE_INDEX  '#'
+
+/* Record index trailer: 8-byte distance back to the index, then these 8 bytes (including the NUL) */
+#define INDEX_MAGIC "OOSFIDX"
+#define INDEX_TRAILER_SIZE 16
 
 #include <cstdio>
 
+enum FormatVersion {
+    kFormatV1 = 1,
+    kFormatV2 = 2
+};
+
+/* OOSFv2 header flags */
+enum FormatFlags {
+    kFlagVarintIntegers = 1 << 0,
+    /*
+     * Struct payloads, and vectors, maps and tuples written through Write(), start with a 4-byte payload size,
+     * so readers can jump over them. Strings inside such frames are not cached: counted from the start of the
+     * innermost frame they take the numbers after the cached strings, so they may refer back to cached strings
+     * and to strings earlier in the same frame. Repeats across sibling frames, such as the labels of consecutive
+     * structs, are written out again; the _framed cases of oosf_bench show the cost. Classes first used inside a
+     * frame are declared again in the next one.
+     */
+    kFlagFramedValues = 1 << 1,
+    /*
+     * Strings may refer to a StringDictionary: cache references -1 - i with i below the dictionary size name its
+     * entries, the string numbers of the cache follow after them. The header goes on with the number of entries
+     * and the 8-byte fingerprint of a dictionary the reader has to be given, or with the entries themselves.
+     * The writer sets one of the two from its constructor arguments.
+     */
+    kFlagSharedDictionary = 1 << 2,
+    kFlagEmbeddedDictionary = 1 << 3,
+
+    kKnownFlags = kFlagVarintIntegers | kFlagFramedValues | kFlagSharedDictionary | kFlagEmbeddedDictionary
+};
+
 class OutputDataStream;
 class InputDataStream;
 
@@ -25,7 +66,9 @@ enum ReadStatus {
     kStatusBadType,
     kStatusMalformedData,
     kStatusReadError,
-    kStatusStringOutOfCache
+    kStatusStringOutOfCache,
+    kStatusUnsupported,
+    kStatusLimitExceeded
 };
 
 class Serializable {
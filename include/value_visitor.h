@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include "types.h"
+
+/*
+ * Callbacks of InputDataStream::VisitValue(), which walks any value by its type tags without knowing its C++
+ * type, e.g. to convert archives to JSON or CSV. Every callback does nothing by default. Strings and runs of
+ * values point into the stream and are only valid during the call.
+ */
+class ValueVisitor {
+public:
+    virtual ~ValueVisitor() = default;
+
+    virtual void OnBool(bool) {
+    }
+
+    /* `tag` is the TYPE_INT* the value was written as */
+    virtual void OnInt(int64_t, int /* tag */) {
+    }
+
+    /* `tag` is TYPE_FLOAT or TYPE_DOUBLE */
+    virtual void OnFloat(double, int /* tag */) {
+    }
+
+    virtual void OnString(std::string_view) {
+    }
+
+    /*
+     * `count` fixed size values of type `tag`, little-endian and possibly unaligned: elements of a vector or
+     * column, delivered in as few runs as the buffering allows. By default every value goes to OnInt / OnFloat.
+     */
+    virtual void OnValues(int tag, const char* data, size_t count) {
+        switch (tag) {
+        case TYPE_INT8:
+            return ForEachValue<int8_t>(tag, data, count);
+        case TYPE_INT16:
+            return ForEachValue<int16_t>(tag, data, count);
+        case TYPE_INT32:
+            return ForEachValue<int32_t>(tag, data, count);
+        case TYPE_INT64:
+            return ForEachValue<int64_t>(tag, data, count);
+        case TYPE_FLOAT:
+            return ForEachValue<float>(tag, data, count);
+        case TYPE_DOUBLE:
+            return ForEachValue<double>(tag, data, count);
+        }
+    }
+
+    /* Lengths are -1 for chunked vectors and maps, which only know theirs at the end */
+    virtual void BeginVector(int64_t /* length */) {
+    }
+
+    virtual void EndVector() {
+    }
+
+    /* Keys and values come alternately */
+    virtual void BeginMap(int64_t /* length */) {
+    }
+
+    virtual void EndMap() {
+    }
+
+    virtual void BeginTuple(int64_t /* arity */) {
+    }
+
+    virtual void EndTuple() {
+    }
+
+    /* The fields come as they were written, each one a complete value */
+    virtual void BeginStruct(std::string_view /* class_name */) {
+    }
+
+    virtual void EndStruct() {
+    }
+
+    /*
+     * Columnar maps and vectors of structs: `columns` vectors of `length` elements each follow, keys then
+     * values or one per field. `class_name` is empty for maps.
+     */
+    virtual void BeginColumns(std::string_view /* class_name */, int64_t /* length */, int64_t /* columns */) {
+    }
+
+    virtual void EndColumns() {
+    }
+
+    /* A record has begun; the values after it belong to it */
+    virtual void OnRecord() {
+    }
+
+private:
+    template <class T>
+    void ForEachValue(int tag, const char* data, size_t count) {
+        for (size_t i = 0; i < count; ++i, data += sizeof(T)) {
+            T value;
+            std::memcpy(&value, data, sizeof(T));
+            if constexpr (std::is_floating_point_v<T>) {
+                OnFloat(value, tag);
+            } else {
+                OnInt(value, tag);
+            }
+        }
+    }
+};
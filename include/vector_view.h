@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+
+/* Read-only view of an encoded arithmetic array. The bytes may be unaligned, so elements are copied out on access */
+template <class T>
+class VectorView {
+public:
+    class Iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = T;
+
+        explicit Iterator(const char* ptr = nullptr) : ptr_(ptr) {
+        }
+
+        T operator*() const {
+            T value;
+            std::memcpy(&value, ptr_, sizeof(T));
+            return value;
+        }
+
+        T operator[](difference_type index) const {
+            return *(*this + index);
+        }
+
+        Iterator& operator++() {
+            ptr_ += sizeof(T);
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator copy = *this;
+            ptr_ += sizeof(T);
+            return copy;
+        }
+
+        Iterator& operator--() {
+            ptr_ -= sizeof(T);
+            return *this;
+        }
+
+        Iterator operator--(int) {
+            Iterator copy = *this;
+            ptr_ -= sizeof(T);
+            return copy;
+        }
+
+        Iterator& operator+=(difference_type count) {
+            ptr_ += count * static_cast<difference_type>(sizeof(T));
+            return *this;
+        }
+
+        Iterator& operator-=(difference_type count) {
+            return *this += -count;
+        }
+
+        Iterator operator+(difference_type count) const {
+            return Iterator(*this) += count;
+        }
+
+        Iterator operator-(difference_type count) const {
+            return Iterator(*this) -= count;
+        }
+
+        difference_type operator-(const Iterator& other) const {
+            return (ptr_ - other.ptr_) / static_cast<difference_type>(sizeof(T));
+        }
+
+        bool operator==(const Iterator& other) const {
+            return ptr_ == other.ptr_;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return ptr_ != other.ptr_;
+        }
+
+        bool operator<(const Iterator& other) const {
+            return ptr_ < other.ptr_;
+        }
+
+    private:
+        const char* ptr_;
+    };
+
+    VectorView() = default;
+
+    VectorView(const char* data, size_t size) : data_(data), size_(size) {
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    const char* data() const {
+        return data_;
+    }
+
+    T operator[](size_t index) const {
+        T value;
+        std::memcpy(&value, data_ + index * sizeof(T), sizeof(T));
+        return value;
+    }
+
+    Iterator begin() const {
+        return Iterator(data_);
+    }
+
+    Iterator end() const {
+        return Iterator(data_ + size_ * sizeof(T));
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
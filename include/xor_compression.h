@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <type_traits>
+
+/*
+ * Gorilla-style compression of floating point series. The first value is stored raw; every next value is
+ * XORed with the previous one and written as a single 0 bit when equal, as 10 + the meaningful bits when they
+ * fit into the previous leading/trailing zero window, or as 11 + 5 bits of leading zeros + 6 bits of
+ * length - 1 + the meaningful bits otherwise. Bits are packed LSB first into little-endian bytes.
+ */
+template <class Float>
+class XorFloatCodec {
+public:
+    using Word = std::conditional_t<sizeof(Float) == 8, uint64_t, uint32_t>;
+    static constexpr int kBits = sizeof(Word) * 8;
+
+    static void Encode(const Float* values, size_t count, std::string* out) {
+        out->clear();
+        BitWriter writer(out);
+        Word previous = 0;
+        int previous_leading = -1;
+        int previous_trailing = 0;
+        for (size_t i = 0; i < count; ++i) {
+            Word value;
+            std::memcpy(&value, &values[i], sizeof(Word));
+            if (i == 0) {
+                writer.Write(value, kBits);
+                previous = value;
+                continue;
+            }
+
+            Word diff = value ^ previous;
+            previous = value;
+            if (diff == 0) {
+                writer.Write(0, 1);
+                continue;
+            }
+
+            int leading = std::min(LeadingZeros(diff), 31);
+            int trailing = TrailingZeros(diff);
+            if (previous_leading >= 0 && leading >= previous_leading && trailing >= previous_trailing) {
+                writer.Write(1, 2);
+                writer.Write(diff >> previous_trailing, kBits - previous_leading - previous_trailing);
+            } else {
+                int length = kBits - leading - trailing;
+                writer.Write(3, 2);
+                writer.Write(leading, 5);
+                writer.Write(length - 1, 6);
+                writer.Write(diff >> trailing, length);
+                previous_leading = leading;
+                previous_trailing = trailing;
+            }
+        }
+        writer.Finish();
+    }
+
+    /* Returns false if the data ends early or describes an impossible window */
+    static bool Decode(const char* data, size_t size, size_t count, Float* values) {
+        BitReader reader(data, size);
+        Word previous = 0;
+        int leading = 0;
+        int trailing = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (i == 0) {
+                previous = reader.Read(kBits);
+            } else if (reader.Read(1) != 0) {
+                if (reader.Read(1) != 0) {
+                    leading = reader.Read(5);
+                    int length = reader.Read(6) + 1;
+                    trailing = kBits - leading - length;
+                    if (trailing < 0) {
+                        return false;
+                    }
+                }
+                previous ^= static_cast<Word>(reader.Read(kBits - leading - trailing)) << trailing;
+            }
+            std::memcpy(&values[i], &previous, sizeof(Word));
+        }
+        return !reader.Overrun();
+    }
+
+private:
+    static int LeadingZeros(Word value) {
+        return sizeof(Word) == 8 ? __builtin_clzll(value) : __builtin_clz(value);
+    }
+
+    static int TrailingZeros(Word value) {
+        return sizeof(Word) == 8 ? __builtin_ctzll(value) : __builtin_ctz(value);
+    }
+
+    class BitWriter {
+    public:
+        explicit BitWriter(std::string* out) : out_(out) {
+        }
+
+        void Write(uint64_t value, int bits) {
+            if (bits == 0) {
+                return;
+            }
+            if (bits < 64) {
+                value &= (1ULL << bits) - 1;
+            }
+            acc_ |= value << count_;
+            if (count_ + bits >= 64) {
+                Flush();
+                acc_ = count_ == 0 ? 0 : value >> (64 - count_);
+                count_ = count_ + bits - 64;
+            } else {
+                count_ += bits;
+            }
+        }
+
+        void Finish() {
+            out_->append(reinterpret_cast<const char*>(&acc_), (count_ + 7) / 8);
+        }
+
+    private:
+        void Flush() {
+            out_->append(reinterpret_cast<const char*>(&acc_), 8);
+        }
+
+        std::string* out_;
+        uint64_t acc_ = 0;
+        int count_ = 0;
+    };
+
+    class BitReader {
+    public:
+        BitReader(const char* data, size_t size) : ptr_(data), end_(data + size) {
+        }
+
+        uint64_t Read(int bits) {
+            if (bits == 0) {
+                return 0;
+            }
+            uint64_t result = acc_;
+            int got = count_;
+            if (got >= bits) {
+                acc_ = bits == 64 ? 0 : acc_ >> bits;
+                count_ -= bits;
+                return bits == 64 ? result : result & ((1ULL << bits) - 1);
+            }
+
+            Refill();
+            int rest = bits - got;
+            if (rest > count_) {
+                overrun_ = true;
+                count_ = rest;
+            }
+            result |= (rest == 64 ? acc_ : acc_ & ((1ULL << rest) - 1)) << got;
+            acc_ = rest == 64 ? 0 : acc_ >> rest;
+            count_ -= rest;
+            return result;
+        }
+
+        bool Overrun() const {
+            return overrun_;
+        }
+
+    private:
+        void Refill() {
+            size_t available = std::min<size_t>(end_ - ptr_, 8);
+            acc_ = 0;
+            std::memcpy(&acc_, ptr_, available);
+            ptr_ += available;
+            count_ = available * 8;
+        }
+
+        const char* ptr_;
+        const char* end_;
+        uint64_t acc_ = 0;
+        int count_ = 0;
+        bool overrun_ = false;
+    };
+};
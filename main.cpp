@@ -2,6 +2,10 @@
 #include <input_data_stream.h>
 #include <iostream>
 #include <fstream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <sstream>
 
 #define LOG(x) std::cerr << #x << ": " << (x) << std::endl;
 
@@ -87,6 +91,7 @@ void WriteTest() {
     stream.RegisterClass<Foo>("Foo");
     stream.Write(f);
 
+    stream.Flush();
     file.close();
 }
 
@@ -129,9 +134,801 @@ void ReadTest() {
     std::fclose(file);
 }
 
+/* Writes `value` alone and in a vector and reads both back as `Read`, the signed type of the same width */
+template <class Read, class T>
+bool RoundTrip(T value, FormatVersion version, int flags) {
+    MemoryOutputSink sink;
+    {
+        OutputDataStream out(&sink, 0, version, flags);
+        out.Write(value);
+        out.Write(std::vector<T>{value, value});
+    }
+    MemoryInputSource source(sink.Data(), sink.Size());
+    InputDataStream in(&source);
+    Read expected = static_cast<Read>(value);
+    Read read = 0;
+    std::vector<Read> vec;
+    return in.TryRead(&read) == kStatusOk && read == expected && in.TryRead(&vec) == kStatusOk &&
+           vec == std::vector<Read>{expected, expected};
+}
+
+void RoundTripTest() {
+    std::pair<FormatVersion, int> formats[] = {{kFormatV1, 0}, {kFormatV2, 0}, {kFormatV2, kFlagVarintIntegers}};
+    for (auto [version, flags] : formats) {
+        bool unsigned_edges = RoundTrip<int16_t>(uint16_t{UINT16_MAX}, version, flags) &&
+                              RoundTrip<int32_t>(uint32_t{3000000000u}, version, flags) &&
+                              RoundTrip<int32_t>(uint32_t{UINT32_MAX}, version, flags) &&
+                              RoundTrip<int64_t>(uint64_t{UINT64_MAX}, version, flags) &&
+                              RoundTrip<int64_t>(uint64_t{1} << 63, version, flags) &&
+                              RoundTrip<int32_t>(int32_t{INT32_MIN}, version, flags) &&
+                              RoundTrip<int64_t>(int64_t{INT64_MIN}, version, flags);
+        LOG(unsigned_edges);
+
+        MemoryOutputSink sink;
+        std::vector<bool> bits{true, false, true};
+        {
+            OutputDataStream out(&sink, 0, version, flags);
+            out.Write(bits);
+            out.WriteAsVector(bits.begin(), bits.end());
+        }
+        MemoryInputSource source(sink.Data(), sink.Size());
+        InputDataStream in(&source);
+        std::vector<int8_t> read;
+        bool bool_vectors = true;
+        for (int i = 0; i < 2; ++i) {
+            bool_vectors = bool_vectors && in.TryRead(&read) == kStatusOk && read == std::vector<int8_t>{1, 0, 1};
+        }
+        LOG(bool_vectors);
+    }
+}
+
+struct Point {
+    int32_t x = 0;
+    std::string label;
+};
+
+OOSF_REFLECT(Point, x, label)
+
+/* Hands out a few bytes per read, so values straddle buffer refills */
+class TrickleInputSource : public InputSource {
+public:
+    TrickleInputSource(const char* data, size_t size, size_t step) : data_(data), size_(size), step_(step) {
+    }
+
+    size_t Read(char* buffer, size_t size) override {
+        size = std::min({size, size_ - pos_, step_});
+        std::memcpy(buffer, data_ + pos_, size);
+        pos_ += size;
+        return size;
+    }
+
+private:
+    const char* data_;
+    size_t size_;
+    size_t pos_ = 0;
+    size_t step_;
+};
+
+/* Skipped OOSFv1 headers cache their class names for the values after them */
+void SkipTest() {
+    bool skipped = true;
+    for (size_t padding = 0; padding < 40; ++padding) {
+        for (size_t step : {1, 2, 3, 5, 7, 11}) {
+            MemoryOutputSink sink;
+            std::vector<Point> points{{1, "x"}, {2, "y"}};
+            {
+                OutputDataStream out(&sink, 16);
+                out.RegisterClass<Point>();
+                out.Write(std::string(padding, 'N'));
+                out.WriteAsColumnarVector(points.begin(), points.end());
+                out.Write(points);
+            }
+            TrickleInputSource source(sink.Data(), sink.Size(), step);
+            InputDataStream in(&source);
+            in.RegisterClass<Point>();
+            std::string str;
+            std::vector<Point> read;
+            skipped = skipped && in.TryRead(&str) == kStatusOk && in.SkipValue() == kStatusOk &&
+                      in.TryRead(&read) == kStatusOk && read.size() == 2 && read[1].label == "y";
+        }
+    }
+    LOG(skipped);
+}
+
+/* Looking at the record index does not disturb sequential reading */
+void RecordCountTest() {
+    for (bool records : {false, true}) {
+        MemoryOutputSink sink;
+        {
+            OutputDataStream out(&sink, 0, kFormatV2);
+            if (records) {
+                out.BeginRecord();
+            }
+            out.Write(1);
+            out.Write(2);
+        }
+        MemoryInputSource source(sink.Data(), sink.Size());
+        InputDataStream in(&source);
+        int32_t first = 0;
+        int32_t second = 0;
+        bool counted = (!records || in.BeginRecord() == kStatusOk) && in.TryRead(&first) == kStatusOk &&
+                       in.RecordCount() == (records ? 1 : -1) && in.TryRead(&second) == kStatusOk &&
+                       first == 1 && second == 2;
+        LOG(counted);
+    }
+}
+
+/* Records written and read on several threads match, and read back in order one at a time */
+void ParallelRecordsTest() {
+    const size_t count = 37;
+    auto words = [](size_t i) {
+        return std::vector<std::string>{"shared", "record " + std::to_string(i % 5), "shared"};
+    };
+    MemoryOutputSink sink;
+    {
+        OutputDataStream out(&sink, 8, kFormatV2);
+        out.WriteRecordsParallel(count, [&](size_t i, OutputDataStream* record) {
+            record->Write(static_cast<int64_t>(i));
+            record->Write(words(i));
+            record->Write(std::string("shared"));
+        }, 4);
+    }
+
+    MemoryInputSource source(sink.Data(), sink.Size());
+    InputDataStream in(&source);
+    std::vector<int> matched(count, 0);
+    ReadStatus status = in.ReadRecordsParallel([&](size_t i, InputDataStream* record) {
+        int64_t index = -1;
+        std::vector<std::string> read;
+        std::string last;
+        ReadStatus status = record->TryRead(&index);
+        status = status == kStatusOk ? record->TryRead(&read) : status;
+        status = status == kStatusOk ? record->TryRead(&last) : status;
+        matched[i] = index == static_cast<int64_t>(i) && read == words(i) && last == "shared";
+        return status;
+    }, 4);
+    bool parallel = status == kStatusOk &&
+                    std::count(matched.begin(), matched.end(), 1) == static_cast<int64_t>(count);
+    LOG(parallel);
+
+    bool sequential = true;
+    for (size_t i = 0; i < count && sequential; ++i) {
+        int64_t index = -1;
+        std::vector<std::string> read;
+        std::string last;
+        sequential = in.BeginRecord() == kStatusOk && in.TryRead(&index) == kStatusOk &&
+                     in.TryRead(&read) == kStatusOk && in.TryRead(&last) == kStatusOk &&
+                     index == static_cast<int64_t>(i) && read == words(i) && last == "shared";
+    }
+    LOG(sequential);
+}
+
+/* Registered under Point's OOSFv1 name, but with a different field list */
+struct PointX {
+    int32_t x = 0;
+};
+
+OOSF_REFLECT(PointX, x)
+
+/* A columnar header that does not match leaves the string numbering as it was */
+void ColumnarMismatchTest() {
+    MemoryOutputSink sink;
+    std::vector<Point> points{{1, "a"}};
+    {
+        OutputDataStream out(&sink, 16);
+        out.RegisterClass<Point>();
+        out.WriteAsColumnarVector(points.begin(), points.end());
+        out.Write(std::string("a"));
+    }
+    MemoryInputSource source(sink.Data(), sink.Size());
+    InputDataStream in(&source);
+    in.RegisterClass<Point>();
+    in.RegisterClass<PointX>("Point");
+    std::vector<PointX> mismatched;
+    std::vector<Point> read;
+    std::string str;
+    bool renumbered = in.TryRead(&mismatched) == kStatusBadType && in.TryRead(&read) == kStatusOk &&
+                      in.TryRead(&str) == kStatusOk && str == "a";
+    LOG(renumbered);
+}
+
+/* Strings inside frames refer back within the frame, also when the reader jumps over frames */
+void FramedStringsTest() {
+    std::string word(100, 'w');
+    std::vector<Point> points{{1, word}, {2, word}};
+    std::vector<std::string> words{word, "b", word, word};
+    MemoryOutputSink sink;
+    {
+        OutputDataStream out(&sink, 16, kFormatV2, kFlagFramedValues);
+        out.RegisterClass<Point>();
+        out.Write(points);
+        out.Write(words);
+        out.Write(word);
+        out.Write(words);
+    }
+    bool framed = sink.Size() < 6 * word.size();
+    for (bool skip : {false, true}) {
+        for (size_t step : {1, 3, 1000}) {
+            TrickleInputSource source(sink.Data(), sink.Size(), step);
+            InputDataStream in(&source);
+            in.RegisterClass<Point>();
+            std::vector<Point> read_points;
+            std::vector<std::string> read_words;
+            std::vector<std::string> more_words;
+            std::string str;
+            framed = framed && (skip ? in.SkipValue() : in.TryRead(&read_points)) == kStatusOk &&
+                     (skip ? in.SkipValue() : in.TryRead(&read_words)) == kStatusOk &&
+                     in.TryRead(&str) == kStatusOk && in.TryRead(&more_words) == kStatusOk &&
+                     str == word && more_words == words &&
+                     (skip || (read_words == words && read_points.size() == 2 && read_points[1].label == word));
+        }
+    }
+    LOG(framed);
+}
+
+/* Compressed vectors encode arrays in place and copy other ranges first; both read back the same */
+void CompressedVectorTest() {
+    std::vector<double> values{1.5, 1.5, 2.25, -3.0, 1e300};
+    std::list<double> list(values.begin(), values.end());
+    std::vector<double> empty;
+    MemoryOutputSink sink;
+    {
+        OutputDataStream out(&sink, 0, kFormatV2);
+        out.WriteAsCompressedVector(values.begin(), values.end());
+        out.WriteAsCompressedVector(values.data(), values.data() + values.size());
+        out.WriteAsCompressedVector(list.begin(), list.end());
+        out.WriteAsCompressedVector(empty.begin(), empty.end());
+    }
+    MemoryInputSource source(sink.Data(), sink.Size());
+    InputDataStream in(&source);
+    bool compressed = true;
+    for (const std::vector<double>& expected : {values, values, values, empty}) {
+        std::vector<double> read{0.0};
+        compressed = compressed && in.TryRead(&read) == kStatusOk && read == expected;
+    }
+    LOG(compressed);
+}
+
+/* Bit-packed integer vectors round trip across block boundaries, widths and wrapping deltas */
+void PackedVectorTest() {
+    uint64_t seed = 12345;
+    auto next = [&seed] {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<int64_t>(seed >> 11) - (int64_t{1} << 52);
+    };
+    std::vector<std::vector<int64_t>> cases;
+    for (size_t length : {0, 1, 255, 256, 257, 1000}) {
+        std::vector<int64_t> monotonic(length);
+        std::vector<int64_t> noisy(length);
+        std::vector<int64_t> extreme(length);
+        for (size_t i = 0; i < length; ++i) {
+            monotonic[i] = -1000 + 7 * static_cast<int64_t>(i);
+            noisy[i] = next() >> (i % 60);
+            extreme[i] = i % 2 ? INT64_MAX : INT64_MIN;
+        }
+        cases.insert(cases.end(), {monotonic, noisy, extreme});
+    }
+    std::vector<int32_t> narrow{-5, 3, INT32_MIN, INT32_MAX, 0};
+    narrow.resize(300, -42);
+
+    MemoryOutputSink sink;
+    {
+        OutputDataStream out(&sink, 0, kFormatV2);
+        for (const auto& values : cases) {
+            out.WriteAsPackedVector(values.begin(), values.end());
+        }
+        out.WriteAsPackedVector(narrow.begin(), narrow.end());
+    }
+    bool packed = true;
+    for (int step : {0, 7}) {
+        MemoryInputSource memory(sink.Data(), sink.Size());
+        TrickleInputSource trickle(sink.Data(), sink.Size(), step);
+        InputDataStream in(step ? static_cast<InputSource*>(&trickle) : &memory);
+        for (const auto& expected : cases) {
+            std::vector<int64_t> read{1, 2, 3};
+            packed = packed && in.TryRead(&read) == kStatusOk && read == expected;
+        }
+        std::vector<int32_t> read;
+        packed = packed && in.TryRead(&read) == kStatusOk && read == narrow;
+    }
+    LOG(packed);
+
+    /* Whatever decoder this build selects agrees with the scalar one at every width */
+    bool decoders_agree = true;
+    for (int width = 0; width <= 64; ++width) {
+        uint64_t mask = width == 64 ? ~0ULL : (1ULL << width) - 1;
+        for (bool sorted : {false, true}) {
+            int64_t values[PackedVectorCodec::kBlockSize];
+            for (int i = 0; i < PackedVectorCodec::kBlockSize; ++i) {
+                values[i] = static_cast<int64_t>(static_cast<uint64_t>(next()) & mask);
+            }
+            if (sorted) {
+                std::sort(values, values + PackedVectorCodec::kBlockSize);
+            }
+            char block[PackedVectorCodec::kMaxBlockBytes];
+            PackedVectorCodec::EncodeBlock(values, -3, block);
+            int64_t decoded[PackedVectorCodec::kBlockSize];
+            int64_t scalar[PackedVectorCodec::kBlockSize];
+            uint64_t reference;
+            std::memcpy(&reference, block + 1, 8);
+            PackedVectorCodec::DecodeBlock(block, -3, decoded);
+            PackedVectorCodec::DecodeScalar(block + 9, block[0] & 0x7f, block[0] & 0x80, reference, -3, scalar);
+            decoders_agree = decoders_agree && std::equal(values, values + PackedVectorCodec::kBlockSize, decoded) &&
+                             std::equal(values, values + PackedVectorCodec::kBlockSize, scalar);
+        }
+    }
+    LOG(decoders_agree);
+}
+
+/* Chunked vectors and maps read back whole, through cursors or skipped, with no chunk, one or several */
+void ChunkedTest() {
+    const size_t chunk = 4;
+    const std::vector<size_t> lengths{0, chunk, 2 * chunk + 2};
+    auto strings = [](size_t length) {
+        std::vector<std::string> values;
+        for (size_t i = 0; i < length; ++i) {
+            values.push_back("s" + std::to_string(i % 3));
+        }
+        return values;
+    };
+    auto map = [](size_t length) {
+        std::map<std::string, int32_t> values;
+        for (size_t i = 0; i < length; ++i) {
+            values["k" + std::to_string(i)] = static_cast<int32_t>(i);
+        }
+        return values;
+    };
+    auto ints = [](size_t length) {
+        std::vector<int32_t> values(length);
+        for (size_t i = 0; i < length; ++i) {
+            values[i] = static_cast<int32_t>(i * i) - 5;
+        }
+        return values;
+    };
+
+    MemoryOutputSink sink;
+    {
+        OutputDataStream out(&sink, 4, kFormatV2);
+        for (size_t length : lengths) {
+            auto vector_values = strings(length);
+            auto map_values = map(length);
+            auto int_values = ints(length);
+            out.WriteAsChunkedVector(vector_values.begin(), vector_values.end(), chunk);
+            out.WriteAsChunkedMap(map_values.begin(), map_values.end(), chunk);
+            out.WriteAsChunkedVector(int_values.begin(), int_values.end(), chunk);
+            out.Write(static_cast<int32_t>(length));
+        }
+    }
+
+    /* Read whole, through cursors, or skipped */
+    for (int mode : {0, 1, 2}) {
+        MemoryInputSource source(sink.Data(), sink.Size());
+        InputDataStream in(&source);
+        bool chunked = true;
+        for (size_t length : lengths) {
+            std::vector<std::string> vector_values;
+            std::map<std::string, int32_t> map_values;
+            std::vector<int32_t> int_values;
+            if (mode == 0) {
+                chunked = chunked && in.TryRead(&vector_values) == kStatusOk && in.TryRead(&map_values) == kStatusOk &&
+                          in.TryRead(&int_values) == kStatusOk;
+            } else if (mode == 1) {
+                VectorCursor<std::string> vector_cursor;
+                chunked = chunked && in.OpenVector(&vector_cursor) == kStatusOk;
+                vector_values.assign(vector_cursor.begin(), vector_cursor.end());
+                chunked = chunked && vector_cursor.Status() == kStatusOk &&
+                          vector_cursor.Size() == static_cast<int64_t>(length) && vector_cursor.Close() == kStatusOk;
+                MapCursor<std::string, int32_t> map_cursor;
+                chunked = chunked && in.OpenMap(&map_cursor) == kStatusOk;
+                map_values.insert(map_cursor.begin(), map_cursor.end());
+                chunked = chunked && map_cursor.Status() == kStatusOk && map_cursor.Close() == kStatusOk;
+                VectorCursor<int32_t> int_cursor;
+                chunked = chunked && in.OpenVector(&int_cursor) == kStatusOk;
+                int_values.assign(int_cursor.begin(), int_cursor.end());
+                chunked = chunked && int_cursor.Status() == kStatusOk && int_cursor.Close() == kStatusOk;
+            } else {
+                chunked = chunked && in.SkipValue() == kStatusOk && in.SkipValue() == kStatusOk &&
+                          in.SkipValue() == kStatusOk;
+                vector_values = strings(length);
+                map_values = map(length);
+                int_values = ints(length);
+            }
+            int32_t sentinel = -1;
+            chunked = chunked && vector_values == strings(length) && map_values == map(length) &&
+                      int_values == ints(length) && in.TryRead(&sentinel) == kStatusOk &&
+                      sentinel == static_cast<int32_t>(length);
+        }
+        LOG(chunked);
+    }
+}
+
+/* Cursors left early, then closed or destroyed, leave the stream at the next value */
+void CursorCloseTest() {
+    std::vector<std::string> strings{"a", "b", "a", "c", "b"};
+    std::vector<int32_t> ints{1, 2, 3, 4, 5, 6};
+    std::vector<int64_t> packed(300);
+    for (size_t i = 0; i < packed.size(); ++i) {
+        packed[i] = static_cast<int64_t>(i) * 3 - 7;
+    }
+    std::map<std::string, int32_t> map{{"x", 1}, {"y", 2}, {"z", 3}};
+    for (int flags : {0, static_cast<int>(kFlagFramedValues)}) {
+        MemoryOutputSink sink;
+        {
+            OutputDataStream out(&sink, 4, kFormatV2, flags);
+            for (int i = 0; i < 2; ++i) {
+                out.Write(strings);
+                out.Write(ints);
+                out.WriteAsPackedVector(packed.begin(), packed.end());
+                out.WriteAsChunkedVector(strings.begin(), strings.end(), 2);
+                out.Write(map);
+                out.Write(std::string("next"));
+            }
+        }
+        MemoryInputSource source(sink.Data(), sink.Size());
+        InputDataStream in(&source);
+        bool left_early = true;
+        for (bool destroy : {false, true}) {
+            auto leave = [&](auto* cursor) {
+                /* Only the first element is read */
+                left_early = left_early && cursor->begin() != cursor->end() &&
+                             (destroy || cursor->Close() == kStatusOk);
+            };
+            {
+                VectorCursor<std::string> cursor;
+                left_early = left_early && in.OpenVector(&cursor) == kStatusOk;
+                leave(&cursor);
+            }
+            {
+                VectorCursor<int32_t> cursor;
+                left_early = left_early && in.OpenVector(&cursor) == kStatusOk;
+                leave(&cursor);
+            }
+            {
+                VectorCursor<int64_t> cursor;
+                left_early = left_early && in.OpenVector(&cursor) == kStatusOk;
+                leave(&cursor);
+            }
+            {
+                VectorCursor<std::string> cursor;
+                left_early = left_early && in.OpenVector(&cursor) == kStatusOk;
+                leave(&cursor);
+            }
+            {
+                MapCursor<std::string, int32_t> cursor;
+                left_early = left_early && in.OpenMap(&cursor) == kStatusOk;
+                leave(&cursor);
+            }
+            std::string next;
+            left_early = left_early && in.TryRead(&next) == kStatusOk && next == "next";
+        }
+        LOG(left_early);
+    }
+}
+
+/* Containers and strings beyond SetMaxAllocation() are refused before they are allocated */
+void LimitExceededTest() {
+    std::vector<MemoryOutputSink> sinks(4);
+    auto write = [&](size_t index, auto write_value) {
+        OutputDataStream out(&sinks[index], 0, kFormatV2);
+        write_value(&out);
+    };
+    std::vector<int32_t> ints(100, 7);
+    write(0, [&](OutputDataStream* out) { out->Write(ints); });
+    write(1, [&](OutputDataStream* out) { out->Write(std::string(200, 's')); });
+    write(2, [&](OutputDataStream* out) { out->Write(std::map<int32_t, int32_t>{{1, 1}, {2, 2}, {3, 3}, {4, 4}}); });
+    write(3, [&](OutputDataStream* out) { out->WriteAsChunkedVector(ints.begin(), ints.end(), 8); });
+
+    bool limit_exceeded = true;
+    for (size_t i = 0; i < sinks.size(); ++i) {
+        for (uint64_t limit : {uint64_t{16}, uint64_t{1024}}) {
+            MemoryInputSource source(sinks[i].Data(), sinks[i].Size());
+            InputDataStream in(&source);
+            in.SetMaxAllocation(limit);
+            std::vector<int32_t> read_ints;
+            std::string read_string;
+            std::map<int32_t, int32_t> read_map;
+            ReadStatus status = i == 1 ? in.TryRead(&read_string)
+                                : i == 2 ? in.TryRead(&read_map) : in.TryRead(&read_ints);
+            limit_exceeded = limit_exceeded && status == (limit < 1024 ? kStatusLimitExceeded : kStatusOk);
+        }
+    }
+    LOG(limit_exceeded);
+}
+
+/* Columnar maps read back into std::map and FlatMap, with bulk and per element columns */
+void ColumnarMapTest() {
+    std::map<std::string, double> prices{{"apple", 1.25}, {"pear", -0.5}, {"plum", 3.0}};
+    std::map<int32_t, std::string> names{{-3, "minus"}, {0, "zero"}, {7, "seven"}, {9, "seven"}};
+    std::map<int32_t, int64_t> empty;
+    MemoryOutputSink sink;
+    {
+        OutputDataStream out(&sink, 4, kFormatV2);
+        for (int i = 0; i < 2; ++i) {
+            out.WriteAsColumnarMap(prices.begin(), prices.end());
+            out.WriteAsColumnarMap(names.begin(), names.end());
+            out.WriteAsColumnarMap(empty.begin(), empty.end());
+        }
+    }
+    MemoryInputSource source(sink.Data(), sink.Size());
+    InputDataStream in(&source);
+    std::map<std::string, double> read_prices;
+    std::map<int32_t, std::string> read_names;
+    std::map<int32_t, int64_t> read_empty;
+    bool columnar_map = in.TryRead(&read_prices) == kStatusOk && in.TryRead(&read_names) == kStatusOk &&
+                        in.TryRead(&read_empty) == kStatusOk && read_prices == prices && read_names == names &&
+                        read_empty.empty();
+    FlatMap<std::string, double> flat_prices;
+    FlatMap<int32_t, std::string> flat_names;
+    FlatMap<int32_t, int64_t> flat_empty;
+    columnar_map = columnar_map && in.TryRead(&flat_prices) == kStatusOk && in.TryRead(&flat_names) == kStatusOk &&
+                   in.TryRead(&flat_empty) == kStatusOk && flat_empty.empty() &&
+                   std::map<std::string, double>(flat_prices.begin(), flat_prices.end()) == prices &&
+                   std::map<int32_t, std::string>(flat_names.begin(), flat_names.end()) == names;
+    LOG(columnar_map);
+}
+
+/* Structs described with OOSF_REFLECT round trip alone and in vectors, under both formats */
+void ReflectTest() {
+    Point point{-4, "origin"};
+    std::vector<Point> points{{1, "a"}, {2, "b"}, {3, "a"}};
+    bool reflected = std::string(StructFields<Point>::kName) == "Point";
+    for (FormatVersion version : {kFormatV1, kFormatV2}) {
+        MemoryOutputSink sink;
+        {
+            OutputDataStream out(&sink, 4, version);
+            out.RegisterClass<Point>();
+            out.Write(point);
+            out.Write(points);
+        }
+        MemoryInputSource source(sink.Data(), sink.Size());
+        InputDataStream in(&source);
+        in.RegisterClass<Point>();
+        Point read_point;
+        std::vector<Point> read_points;
+        reflected = reflected && in.TryRead(&read_point) == kStatusOk && in.TryRead(&read_points) == kStatusOk &&
+                    read_point.x == point.x && read_point.label == point.label &&
+                    read_points.size() == points.size();
+        for (size_t i = 0; reflected && i < points.size(); ++i) {
+            reflected = read_points[i].x == points[i].x && read_points[i].label == points[i].label;
+        }
+    }
+    LOG(reflected);
+}
+
+/* Writes every callback it receives as one line */
+class RecordingVisitor : public ValueVisitor {
+public:
+    std::string log;
+
+    void OnBool(bool value) override {
+        log += std::string("bool ") + (value ? "true" : "false") + "\n";
+    }
+
+    void OnInt(int64_t value, int tag) override {
+        log += "int " + std::to_string(value) + " " + std::to_string(tag) + "\n";
+    }
+
+    void OnFloat(double value, int tag) override {
+        log += "float " + std::to_string(value) + " " + std::to_string(tag) + "\n";
+    }
+
+    void OnString(std::string_view value) override {
+        log += "string " + std::string(value) + "\n";
+    }
+
+    void BeginVector(int64_t length) override {
+        log += "vector " + std::to_string(length) + "\n";
+    }
+
+    void EndVector() override {
+        log += "end vector\n";
+    }
+
+    void BeginMap(int64_t length) override {
+        log += "map " + std::to_string(length) + "\n";
+    }
+
+    void EndMap() override {
+        log += "end map\n";
+    }
+
+    void BeginTuple(int64_t arity) override {
+        log += "tuple " + std::to_string(arity) + "\n";
+    }
+
+    void EndTuple() override {
+        log += "end tuple\n";
+    }
+
+    void BeginStruct(std::string_view class_name) override {
+        log += "struct " + std::string(class_name) + "\n";
+    }
+
+    void EndStruct() override {
+        log += "end struct\n";
+    }
+
+    void BeginColumns(std::string_view class_name, int64_t length, int64_t columns) override {
+        log += "columns " + std::string(class_name) + " " + std::to_string(length) + " " + std::to_string(columns) +
+               "\n";
+    }
+
+    void EndColumns() override {
+        log += "end columns\n";
+    }
+
+    void OnRecord() override {
+        log += "record\n";
+    }
+};
+
+/* VisitValue() reports a mixed framed stream callback by callback and stops at the record index */
+void VisitTest() {
+    std::map<std::string, int32_t> map{{"k", 2}};
+    std::map<int32_t, std::string> columnar{{1, "k"}, {2, "v"}};
+    MemoryOutputSink sink;
+    {
+        OutputDataStream out(&sink, 4, kFormatV2, kFlagFramedValues);
+        out.RegisterClass<Point>();
+        out.BeginRecord();
+        out.Write(true);
+        out.Write(static_cast<int8_t>(-3));
+        out.Write(2.5);
+        out.Write(std::string("k"));
+        out.Write(std::vector<int32_t>{4, 5});
+        out.Write(map);
+        out.WriteAsTuple(static_cast<int64_t>(6), std::string("k"));
+        out.Write(Point{7, "p"});
+        out.WriteAsColumnarMap(columnar.begin(), columnar.end());
+    }
+    MemoryInputSource source(sink.Data(), sink.Size());
+    InputDataStream in(&source);
+    RecordingVisitor visitor;
+    ReadStatus status = kStatusOk;
+    int values = 0;
+    while ((status = in.VisitValue(&visitor)) == kStatusOk) {
+        ++values;
+    }
+    std::string expected = "record\nbool true\n"
+                           "int -3 " + std::to_string(TYPE_INT8) + "\n"
+                           "float 2.500000 " + std::to_string(TYPE_DOUBLE) + "\n"
+                           "string k\n"
+                           "vector 2\nint 4 " + std::to_string(TYPE_INT32) + "\nint 5 " + std::to_string(TYPE_INT32) +
+                           "\nend vector\n"
+                           "map 1\nstring k\nint 2 " + std::to_string(TYPE_INT32) + "\nend map\n"
+                           "tuple 2\nint 6 " + std::to_string(TYPE_INT64) + "\nstring k\nend tuple\n"
+                           "struct Point\nint 7 " + std::to_string(TYPE_INT32) + "\nstring p\nend struct\n"
+                           "columns  2 2\nvector 2\nint 1 " + std::to_string(TYPE_INT32) + "\nint 2 " +
+                           std::to_string(TYPE_INT32) + "\nend vector\nvector 2\nstring k\nstring v\nend vector\n"
+                           "end columns\n";
+    bool visited = values == 10 && status == kStatusBadType && visitor.log == expected;
+    LOG(visited);
+}
+
+/* Corrupt lengths from streaming sources fail with a status instead of being allocated up front */
+void CorruptLengthTest() {
+    MemoryOutputSink sink;
+    {
+        OutputDataStream out(&sink, 0, kFormatV2);
+        out.RegisterClass<Point>();
+        out.Write(std::string("abc"));
+        out.Write(std::vector<std::string>{"x", "yy"});
+        out.Write(std::map<std::string, int32_t>{{"k", 1}});
+        out.Write(Point{1, "zz"});
+        out.Write(std::vector<int32_t>{1, 2, 3});
+    }
+    bool corrupt = true;
+    for (size_t pos = 0; pos < sink.Size(); ++pos) {
+        for (char last : {'\x7f', '\x3f'}) {
+            std::string data(sink.Data(), sink.Size());
+            data.replace(pos, 9, std::string(8, '\xff') + last);
+            TrickleInputSource source(data.data(), data.size(), 10);
+            try {
+                InputDataStream in(&source);
+                in.RegisterClass<Point>();
+                std::string str;
+                std::vector<std::string> strings;
+                std::map<std::string, int32_t> map;
+                Point point;
+                std::vector<int32_t> ints;
+                in.TryRead(&str);
+                in.TryRead(&strings);
+                in.TryRead(&map);
+                in.TryRead(&point);
+                in.TryRead(&ints);
+            } catch (const std::exception&) {
+                corrupt = false;
+            }
+        }
+    }
+    LOG(corrupt);
+}
+
+/* The maximum allocation given to the constructor already bounds the header */
+void HeaderLimitTest() {
+    StringDictionary dictionary({std::string(100, 'd')});
+    MemoryOutputSink sink;
+    {
+        OutputDataStream out(&sink, 0, kFormatV2, kFlagEmbeddedDictionary, &dictionary);
+        out.Write(std::string(100, 'd'));
+    }
+    MemoryInputSource limited_source(sink.Data(), sink.Size());
+    InputDataStream limited(&limited_source, nullptr, nullptr, 64);
+    MemoryInputSource source(sink.Data(), sink.Size());
+    InputDataStream in(&source, nullptr, nullptr, 128);
+    std::string str;
+    bool limited_header = !limited && in && in.TryRead(&str) == kStatusOk && str == dictionary.At(0);
+    LOG(limited_header);
+}
+
+/* Dictionaries from samples, shared or embedded; a reader with another shared dictionary refuses the stream */
+void DictionaryTest() {
+    std::istringstream samples("alpha beta alpha beta alpha gamma");
+    StringDictionary dictionary = StringDictionary::FromSamples(std::istream_iterator<std::string>(samples),
+                                                                std::istream_iterator<std::string>(), 10);
+    bool sampled = dictionary.Entries() == std::vector<std::string>{"alpha", "beta"};
+    LOG(sampled);
+
+    std::vector<std::string> strings{"beta", "delta", "alpha", "delta"};
+    StringDictionary other({"alpha", "beta", "delta"});
+    for (int flags : {0, static_cast<int>(kFlagEmbeddedDictionary)}) {
+        MemoryOutputSink sink;
+        {
+            OutputDataStream out(&sink, 4, kFormatV2, flags, &dictionary);
+            out.Write(strings);
+        }
+        MemoryInputSource source(sink.Data(), sink.Size());
+        InputDataStream in(&source, nullptr, flags ? nullptr : &dictionary);
+        std::vector<std::string> read;
+        bool dictionary_round_trip = in.TryRead(&read) == kStatusOk && read == strings;
+        LOG(dictionary_round_trip);
+        if (!flags) {
+            MemoryInputSource other_source(sink.Data(), sink.Size());
+            InputDataStream mismatched(&other_source, nullptr, &other);
+            bool refused = !mismatched && mismatched.HeaderStatus() == kStatusBadType &&
+                           mismatched.TryRead(&read) != kStatusOk;
+            LOG(refused);
+        }
+    }
+}
+
+/* Whatever is written after Close() is refused instead of being lost */
+void AsyncCloseTest() {
+    MemoryOutputSink target;
+    AsyncOutputSink sink(&target);
+    sink.Write("abc", 3);
+    sink.Close();
+    bool refused = false;
+    try {
+        sink.Write("def", 3);
+    } catch (const std::runtime_error&) {
+        refused = true;
+    }
+    refused = refused && target.Size() == 3;
+    LOG(refused);
+}
+
 int main() {
     WriteTest();
     ReadTest();
+    RoundTripTest();
+    SkipTest();
+    RecordCountTest();
+    ParallelRecordsTest();
+    ColumnarMismatchTest();
+    FramedStringsTest();
+    CompressedVectorTest();
+    PackedVectorTest();
+    ChunkedTest();
+    CursorCloseTest();
+    LimitExceededTest();
+    ColumnarMapTest();
+    ReflectTest();
+    VisitTest();
+    CorruptLengthTest();
+    HeaderLimitTest();
+    DictionaryTest();
+    AsyncCloseTest();
 
     return 0;
 }